@@ -0,0 +1,457 @@
+// DataLayout.cpp
+// Where data blocks live: in the disk file itself, or spread over member files
+#include "VirtualFileSystem.h"
+#include "Profile.h"
+#include "IoStats.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <array>
+
+using namespace std;
+
+// CRC32 (IEEE 802.3) of one block, table driven
+static uint32_t blockChecksum(const char *data) {
+    static const auto table = [] {
+        array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Read the CRC32 table of a mirrored disk
+bool VirtualFileSystem::readChecksums() {
+    checksums.assign(sb.totalBlocks, 0);
+    disk.seekg(static_cast<uint64_t>(sb.sumStartBlock) * BLOCK_SIZE);
+    disk.read(reinterpret_cast<char *>(checksums.data()), sb.totalBlocks * sizeof(uint32_t));
+    ioAccount(diskIo, IO_TABLES, false, static_cast<uint64_t>(sb.sumStartBlock) * BLOCK_SIZE,
+              sb.totalBlocks * sizeof(uint32_t));
+    return disk.good();
+}
+
+// Write the CRC32 table of a mirrored disk
+bool VirtualFileSystem::writeChecksums() {
+    disk.seekp(static_cast<uint64_t>(sb.sumStartBlock) * BLOCK_SIZE);
+    disk.write(reinterpret_cast<char *>(checksums.data()), sb.totalBlocks * sizeof(uint32_t));
+    ioAccount(diskIo, IO_TABLES, true, static_cast<uint64_t>(sb.sumStartBlock) * BLOCK_SIZE,
+              sb.totalBlocks * sizeof(uint32_t));
+    return disk.good();
+}
+
+// Number of blocks in a member file
+uint32_t VirtualFileSystem::memberBlockCount(const uint32_t member) const {
+    if (sb.imageType == IMAGE_TIERED) {
+        return member == 0 ? sb.fastBlocks : sb.totalBlocks - sb.dataStartBlock;
+    }
+    if (sb.imageType == IMAGE_MIRRORED || sb.imageType == IMAGE_SPLIT) {
+        return sb.totalBlocks - sb.dataStartBlock;
+    }
+    const uint32_t dataBlocks = sb.totalBlocks - sb.dataStartBlock;
+    const uint32_t units = (dataBlocks + sb.stripeBlocks - 1) / sb.stripeBlocks;
+    if (sb.imageType == IMAGE_PARITY) {
+        // One unit per member for every row of data units
+        const uint32_t dataColumns = sb.memberCount - sb.parityCount;
+        return (units + dataColumns - 1) / dataColumns * sb.stripeBlocks;
+    }
+    const uint32_t unitsPerMember = (units + sb.memberCount - 1) / sb.memberCount;
+    return unitsPerMember * sb.stripeBlocks;
+}
+
+// Create and size the member files of a new disk, then open them
+bool VirtualFileSystem::createMembers() {
+    for (uint32_t m = 0; m < sb.memberCount; ++m) {
+        const string path = resolveBackingPath(sb.members[m], MEMBER_PATH_LEN);
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out) {
+            cerr << "Error: Cannot create member file '" << path << "'\n";
+            return false;
+        }
+        out.seekp(static_cast<uint64_t>(memberBlockCount(m)) * BLOCK_SIZE - 1);
+        constexpr char zero = '\0';
+        out.write(&zero, 1);
+    }
+    return openMembers(false);
+}
+
+// Open the member files of a loaded disk
+// Mirror and parity disks keep working with missing members, as long as the data can still be found
+bool VirtualFileSystem::openMembers(const bool readOnly) {
+    PROFILE_SCOPE("openMembers");
+    memberFiles.clear();
+    memberFiles.resize(sb.memberCount);
+    memberIo.assign(sb.memberCount, IoCursor());
+    memberMissing.assign(sb.memberCount, 0);
+    uint32_t missing = 0;
+    for (uint32_t m = 0; m < sb.memberCount; ++m) {
+        const string path = resolveBackingPath(sb.members[m], MEMBER_PATH_LEN);
+        memberFiles[m].open(path, readOnly ? ios::binary | ios::in : ios::binary | ios::in | ios::out);
+        if (memberFiles[m] && (sb.staleMembers & (1u << m))) {
+            cerr << "Warning: Member file '" << path << "' is out of date, continuing without it (see drebuild)\n";
+            memberMissing[m] = 1;
+            ++missing;
+        } else if (!memberFiles[m]) {
+            if (sb.imageType != IMAGE_MIRRORED && sb.imageType != IMAGE_PARITY) {
+                cerr << "Error: Cannot open member file '" << path << "'\n";
+                return false;
+            }
+            cerr << "Warning: Cannot open member file '" << path << "', continuing without it\n";
+            memberMissing[m] = 1;
+            ++missing;
+        }
+    }
+    // A mirror needs one member, a parity disk all but parityCount of them
+    const uint32_t tolerated = sb.imageType == IMAGE_PARITY ? sb.parityCount : sb.memberCount - 1;
+    if (missing > tolerated) {
+        cerr << "Error: Too many member files are missing (" << missing << " of " << sb.memberCount << ")\n";
+        return false;
+    }
+    return true;
+}
+
+// Remember members that missed a write, they must not be read from until rebuilt
+void VirtualFileSystem::markStale(const vector<char> &lost) {
+    uint32_t stale = sb.staleMembers;
+    for (uint32_t m = 0; m < sb.memberCount; ++m) {
+        if (lost[m]) stale |= 1u << m;
+    }
+    if (stale != sb.staleMembers) {
+        sb.staleMembers = stale;
+        writeSuperblock();
+    }
+}
+
+// Bring missing and out-of-date members back, recreating their files if needed
+// Mirrors copy from a healthy member, parity disks rebuild the members' columns row by row
+bool VirtualFileSystem::rebuildMembers() {
+    PROFILE_SCOPE("rebuildMembers");
+    if (sb.imageType != IMAGE_MIRRORED && sb.imageType != IMAGE_PARITY) {
+        cerr << "Error: Only mirrored and parity disks can be rebuilt\n";
+        return false;
+    }
+    vector<uint32_t> targets;
+    for (uint32_t m = 0; m < sb.memberCount; ++m) {
+        if (!memberMissing[m]) continue;
+        const string path = resolveBackingPath(sb.members[m], MEMBER_PATH_LEN);
+        if (!memberFiles[m].is_open()) {
+            ofstream out(path, ios::binary | ios::trunc);
+            out.seekp(static_cast<uint64_t>(memberBlockCount(m)) * BLOCK_SIZE - 1);
+            constexpr char zero = '\0';
+            out.write(&zero, 1);
+            out.close();
+            memberFiles[m].open(path, ios::binary | ios::in | ios::out);
+        }
+        if (!memberFiles[m]) {
+            cerr << "Error: Cannot recreate member file '" << path << "'\n";
+            return false;
+        }
+        memberFiles[m].clear();
+        targets.push_back(m);
+    }
+    if (targets.empty()) {
+        cout << "All members of '" << diskPath << "' are up to date.\n";
+        return true;
+    }
+
+    const uint32_t memberBlocks = memberBlockCount(0);
+    if (sb.imageType == IMAGE_MIRRORED) {
+        const auto source = static_cast<uint32_t>(find(memberMissing.begin(), memberMissing.end(), 0) - memberMissing.begin());
+        vector<char> buffer(IO_BATCH_BLOCKS * BLOCK_SIZE);
+        for (uint32_t first = 0; first < memberBlocks; first += IO_BATCH_BLOCKS) {
+            const uint32_t count = min(IO_BATCH_BLOCKS, memberBlocks - first);
+            vector<pair<uint64_t, size_t> > run(count);
+            for (uint32_t i = 0; i < count; ++i) run[i] = {first + i, i};
+            if (!transferRun(memberFiles[source], memberIo[source], run, buffer.data(), false)) return false;
+            for (const uint32_t m: targets) {
+                if (!transferRun(memberFiles[m], memberIo[m], run, buffer.data(), true)) return false;
+            }
+        }
+    } else {
+        const uint32_t unit = sb.stripeBlocks, rows = memberBlocks / unit;
+        const uint32_t rowsPerBatch = max(1u, IO_BATCH_BLOCKS / (unit * sb.memberCount));
+        vector<char> staging(static_cast<size_t>(rowsPerBatch) * sb.memberCount * unit * BLOCK_SIZE);
+        for (uint32_t first = 0; first < rows; first += rowsPerBatch) {
+            vector<uint32_t> batch;
+            for (uint32_t r = first; r < min(rows, first + rowsPerBatch); ++r) batch.push_back(r);
+            if (!readParityRows(batch, staging.data(), false)) return false;
+            vector<vector<pair<uint64_t, size_t> > > runs(sb.memberCount);
+            for (size_t slot = 0; slot < batch.size(); ++slot) {
+                for (uint32_t c = 0; c < sb.memberCount; ++c) {
+                    const uint32_t m = parityMember(batch[slot], c);
+                    if (!memberMissing[m]) continue;
+                    for (uint32_t off = 0; off < unit; ++off) {
+                        runs[m].emplace_back(static_cast<uint64_t>(batch[slot]) * unit + off,
+                                             (slot * sb.memberCount + c) * unit + off);
+                    }
+                }
+            }
+            const vector<char> ok = transferMembers(runs, staging.data(), true);
+            if (!all_of(ok.begin(), ok.end(), [](const char good) { return good != 0; })) return false;
+        }
+    }
+
+    for (const uint32_t m: targets) {
+        memberMissing[m] = 0;
+        sb.staleMembers &= ~(1u << m);
+    }
+    writeSuperblock();
+    syncDisk();
+    cout << "Rebuilt " << targets.size() << " member file(s) of '" << diskPath << "'.\n";
+    return true;
+}
+
+// Map a data block to its member file and block index inside it
+// Striped: consecutive runs of stripeBlocks data blocks go round-robin over the members
+// Mirrored: every member has the block at the same index, the member returned is the preferred reader
+// Split: the data file holds the data blocks back to back
+pair<uint32_t, uint64_t> VirtualFileSystem::locateBlock(const uint32_t blk) const {
+    const uint32_t dataBlock = blk - sb.dataStartBlock;
+    if (sb.imageType == IMAGE_SPLIT) {
+        return {0, dataBlock};
+    }
+    const uint32_t unit = dataBlock / sb.stripeBlocks;
+    if (sb.imageType == IMAGE_MIRRORED) {
+        return {unit % sb.memberCount, dataBlock};
+    }
+    if (sb.imageType == IMAGE_PARITY) {
+        const uint32_t dataColumns = sb.memberCount - sb.parityCount;
+        const uint32_t row = unit / dataColumns;
+        return {parityMember(row, unit % dataColumns),
+                static_cast<uint64_t>(row) * sb.stripeBlocks + dataBlock % sb.stripeBlocks};
+    }
+    return {unit % sb.memberCount,
+            static_cast<uint64_t>(unit / sb.memberCount) * sb.stripeBlocks + dataBlock % sb.stripeBlocks};
+}
+
+// Plain disks keep the block in the disk file itself, split and striped disks in the member locateBlock picks
+bool VirtualFileSystem::blockLocation(const uint32_t blk, string &path, uint64_t &offset) const {
+    if (sb.imageType == IMAGE_PLAIN) {
+        path = diskPath;
+        offset = static_cast<uint64_t>(blk) * BLOCK_SIZE;
+        return true;
+    }
+    if (sb.imageType != IMAGE_SPLIT && sb.imageType != IMAGE_STRIPED) return false;
+    const auto [member, index] = locateBlock(blk);
+    path = resolveBackingPath(sb.members[member], MEMBER_PATH_LEN);
+    offset = index * BLOCK_SIZE;
+    return true;
+}
+
+// Transfer blocks of one file, in block order, seeking only where they are not consecutive
+// Each entry is (block index in the file, position in the caller's buffer)
+bool VirtualFileSystem::transferRun(fstream &file, IoCursor &cursor, vector<pair<uint64_t, size_t> > &run,
+                                    char *buffer, const bool write) {
+    PROFILE_SPAN(write ? "write run" : "read run", "io");
+    sort(run.begin(), run.end());
+    uint64_t next = UINT64_MAX, start = 0;
+    for (const auto &[index, position]: run) {
+        if (index != next) {
+            if (next != UINT64_MAX) ioAccount(cursor, IO_DATA, write, start * BLOCK_SIZE, (next - start) * BLOCK_SIZE,
+                                              static_cast<uint32_t>(next - start));
+            if (write) file.seekp(index * BLOCK_SIZE);
+            else file.seekg(index * BLOCK_SIZE);
+            start = index;
+        }
+        if (write) file.write(buffer + position * BLOCK_SIZE, BLOCK_SIZE);
+        else file.read(buffer + position * BLOCK_SIZE, BLOCK_SIZE);
+        next = index + 1;
+    }
+    if (next != UINT64_MAX) ioAccount(cursor, IO_DATA, write, start * BLOCK_SIZE, (next - start) * BLOCK_SIZE,
+                                      static_cast<uint32_t>(next - start));
+    return file.good();
+}
+
+// Move a batch of blocks between the buffer and wherever they live
+bool VirtualFileSystem::transferBlocks(const vector<int32_t> &blocks, char *buffer, const bool write) {
+    if (sb.imageType == IMAGE_MIRRORED) {
+        return write ? writeMirrored(blocks, buffer) : readMirrored(blocks, buffer);
+    }
+    if (sb.memberCount == 0) {
+        vector<pair<uint64_t, size_t> > run(blocks.size());
+        for (size_t i = 0; i < blocks.size(); ++i) run[i] = {static_cast<uint64_t>(blocks[i]), i};
+        return transferRun(disk, diskIo, run, buffer, write);
+    }
+
+    if (sb.imageType == IMAGE_PARITY) {
+        return write ? writeParity(blocks, buffer) : readParity(blocks, buffer);
+    }
+    if (sb.imageType == IMAGE_TIERED) {
+        return transferTiered(blocks, buffer, write);
+    }
+
+    vector<vector<pair<uint64_t, size_t> > > runs(sb.memberCount);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        const auto [member, index] = locateBlock(blocks[i]);
+        runs[member].emplace_back(index, i);
+    }
+    const vector<char> ok = transferMembers(runs, buffer, write);
+    return all_of(ok.begin(), ok.end(), [](const char good) { return good != 0; });
+}
+
+// Transfer one run per member file in parallel, returns which members succeeded
+// Every member with work gets its own thread, the calling thread takes the last one
+vector<char> VirtualFileSystem::transferMembers(vector<vector<pair<uint64_t, size_t> > > &runs, char *buffer,
+                                                const bool write) {
+    vector<char> ok(sb.memberCount, 1);
+    vector<thread> workers;
+    uint32_t last = sb.memberCount;
+    for (uint32_t m = 0; m < sb.memberCount; ++m) {
+        if (runs[m].empty()) continue;
+        if (last < sb.memberCount) {
+            workers.emplace_back([&, l = last] {
+                ok[l] = transferRun(memberFiles[l], memberIo[l], runs[l], buffer, write);
+            });
+        }
+        last = m;
+    }
+    if (last < sb.memberCount) ok[last] = transferRun(memberFiles[last], memberIo[last], runs[last], buffer, write);
+    PROFILE_SPAN("wait for members", "wait");
+    for (auto &worker: workers) worker.join();
+    return ok;
+}
+
+// Read a batch from a mirror
+// Read units (stripeBlocks consecutive blocks) are queued on their preferred member. A member that
+// runs out of work takes units from the longest remaining queue, so one slow device can't hold up
+// the batch. Blocks that fail to read or don't match their checksum are retried on the other members
+bool VirtualFileSystem::readMirrored(const vector<int32_t> &blocks, char *buffer) {
+    const uint32_t members = sb.memberCount;
+    vector<vector<vector<pair<uint64_t, size_t> > > > queues(members);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        auto [member, index] = locateBlock(blocks[i]);
+        while (memberMissing[member]) member = (member + 1) % members;
+        auto &queue = queues[member];
+        const uint64_t unit = index / sb.stripeBlocks;
+        if (queue.empty() || queue.back().front().first / sb.stripeBlocks != unit) queue.emplace_back();
+        queue.back().emplace_back(index, i);
+    }
+
+    vector<atomic<size_t> > next(members);
+    vector<vector<size_t> > failed(members);
+    auto worker = [&](const uint32_t m) {
+        while (true) {
+            // Own queue first, then the one with the most units left
+            uint32_t from = m;
+            if (next[m].load() >= queues[m].size()) {
+                size_t most = 0;
+                for (uint32_t q = 0; q < members; ++q) {
+                    if (const size_t taken = next[q].load(); taken < queues[q].size() && queues[q].size() - taken > most) {
+                        most = queues[q].size() - taken;
+                        from = q;
+                    }
+                }
+                if (most == 0) return;
+            }
+            const size_t claimed = next[from].fetch_add(1);
+            if (claimed >= queues[from].size()) continue;
+            auto run = queues[from][claimed];
+            transferRun(memberFiles[m], memberIo[m], run, buffer, false);
+            memberFiles[m].clear();
+            for (const auto &[index, position]: run) {
+                if (blockChecksum(buffer + position * BLOCK_SIZE) != checksums[blocks[position]]) {
+                    failed[m].push_back(position);
+                }
+            }
+        }
+    };
+    vector<thread> workers;
+    uint32_t self = members;
+    for (uint32_t m = 0; m < members; ++m) {
+        if (memberMissing[m]) continue;
+        if (self < members) workers.emplace_back(worker, self);
+        self = m;
+    }
+    worker(self);
+    PROFILE_SPAN("wait for members", "wait");
+    for (auto &w: workers) w.join();
+
+    // Retry the bad blocks on every other member until one has a good copy
+    for (uint32_t m = 0; m < members; ++m) {
+        for (const size_t position: failed[m]) {
+            const uint64_t index = locateBlock(blocks[position]).second;
+            bool repaired = false;
+            for (uint32_t other = 0; other < members && !repaired; ++other) {
+                if (other == m || memberMissing[other]) continue;
+                vector<pair<uint64_t, size_t> > one{{index, position}};
+                transferRun(memberFiles[other], memberIo[other], one, buffer, false);
+                memberFiles[other].clear();
+                repaired = blockChecksum(buffer + position * BLOCK_SIZE) == checksums[blocks[position]];
+            }
+            if (!repaired) {
+                cerr << "Error: No mirror member has a good copy of block " << blocks[position] << "\n";
+                return false;
+            }
+        }
+        if (!failed[m].empty()) {
+            cerr << "Warning: " << failed[m].size() << " blocks were bad on mirror member '" << sb.members[m]
+                    << "', read them from another member\n";
+        }
+    }
+    return true;
+}
+
+// Write a batch to every member of a mirror in parallel, recording the checksums
+// The write succeeds as long as one member took it, the others are marked stale
+bool VirtualFileSystem::writeMirrored(const vector<int32_t> &blocks, const char *buffer) {
+    vector<pair<uint64_t, size_t> > run(blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        checksums[blocks[i]] = blockChecksum(buffer + i * BLOCK_SIZE);
+        run[i] = {locateBlock(blocks[i]).second, i};
+    }
+    vector<char> ok(sb.memberCount, 0);
+    vector<thread> workers;
+    for (uint32_t m = 0; m < sb.memberCount; ++m) {
+        if (memberMissing[m]) continue;
+        workers.emplace_back([&, m, run]() mutable {
+            ok[m] = transferRun(memberFiles[m], memberIo[m], run, const_cast<char *>(buffer), true);
+        });
+    }
+    {
+        PROFILE_SPAN("wait for members", "wait");
+        for (auto &w: workers) w.join();
+    }
+    vector<char> lost(sb.memberCount, 0);
+    for (uint32_t m = 0; m < sb.memberCount; ++m) {
+        if (!memberMissing[m] && !ok[m]) {
+            cerr << "Warning: Write to mirror member '" << sb.members[m] << "' failed\n";
+        }
+        lost[m] = memberMissing[m] || !ok[m];
+    }
+    markStale(lost);
+    return any_of(ok.begin(), ok.end(), [](const char good) { return good != 0; });
+}
+
+// Read a batch of data blocks; overlays go block by block, since each may come from the base
+bool VirtualFileSystem::readDataBlocks(const vector<int32_t> &blocks, char *buffer) {
+    PROFILE_SCOPE("readDataBlocks");
+    if (sb.imageType == IMAGE_OVERLAY) {
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (!readDataBlock(blocks[i], buffer + i * BLOCK_SIZE)) return false;
+        }
+        return true;
+    }
+    return transferBlocks(blocks, buffer, false);
+}
+
+// Write a batch of data blocks
+bool VirtualFileSystem::writeDataBlocks(const vector<int32_t> &blocks, const char *buffer) {
+    PROFILE_SCOPE("writeDataBlocks");
+    // The buffer is only read from when writing
+    if (!transferBlocks(blocks, const_cast<char *>(buffer), true)) return false;
+    if (sb.imageType == IMAGE_OVERLAY) {
+        for (const int32_t blk: blocks) {
+            blockMap[blk / 8] |= static_cast<uint8_t>(1 << (blk % 8));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+// Format.cpp
+// Escaping for the JSON and CSV outputs
+#include "Format.h"
+#include <cstdio>
+
+using namespace std;
+
+bool parseFormat(const std::string &arg, uint32_t &format) {
+    if (arg == "--format=table") format = FORMAT_TABLE;
+    else if (arg == "--format=json") format = FORMAT_JSON;
+    else if (arg == "--format=csv") format = FORMAT_CSV;
+    else return false;
+    return true;
+}
+
+std::string jsonString(const std::string &text) {
+    string quoted = "\"";
+    for (const char c: text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+std::string csvField(const std::string &text) {
+    if (text.find_first_of(",\"\r\n") == string::npos) return text;
+    string quoted = "\"";
+    for (const char c: text) {
+        if (c == '"') quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
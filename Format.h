@@ -0,0 +1,24 @@
+//
+// Output formats of the listing commands (dls, dmap, dstats): the aligned table for people, and
+// JSON or CSV with exact numbers for scripts, written out as they are produced
+//
+
+#ifndef FORMAT_H
+#define FORMAT_H
+#include    <string>
+#include    <cstdint>
+
+static constexpr uint32_t FORMAT_TABLE = 0;
+static constexpr uint32_t FORMAT_JSON = 1;
+static constexpr uint32_t FORMAT_CSV = 2;
+
+// "--format=json" or "--format=csv" (or "--format=table"), false for anything else
+bool parseFormat(const std::string &arg, uint32_t &format);
+
+// A string as a quoted JSON string
+std::string jsonString(const std::string &text);
+
+// A string as a CSV field, quoted only when it has to be
+std::string csvField(const std::string &text);
+
+#endif //FORMAT_H
@@ -0,0 +1,134 @@
+// GaloisField.cpp
+#include "GaloisField.h"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF_X86 1
+#endif
+
+using namespace std;
+
+// Log and antilog tables, the antilog table is doubled so log sums need no modulo
+struct GfTables {
+    array<uint8_t, 512> exp{};
+    array<uint8_t, 256> log{};
+
+    GfTables() {
+        uint32_t x = 1;
+        for (uint32_t i = 0; i < 255; ++i) {
+            exp[i] = exp[i + 255] = static_cast<uint8_t>(x);
+            log[x] = static_cast<uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11D;
+        }
+    }
+};
+
+static const GfTables &tables() {
+    static const GfTables t;
+    return t;
+}
+
+uint8_t gfMul(const uint8_t a, const uint8_t b) {
+    if (a == 0 || b == 0) return 0;
+    const GfTables &t = tables();
+    return t.exp[t.log[a] + t.log[b]];
+}
+
+uint8_t gfInv(const uint8_t a) {
+    const GfTables &t = tables();
+    return t.exp[255 - t.log[a]];
+}
+
+uint8_t gfPow2(const int32_t n) {
+    return tables().exp[((n % 255) + 255) % 255];
+}
+
+void gfXorInto(uint8_t *dst, const uint8_t *src, size_t len) {
+    // Word at a time, the compiler vectorises this further
+    for (; len >= 8; len -= 8, dst += 8, src += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst, 8);
+        memcpy(&b, src, 8);
+        a ^= b;
+        memcpy(dst, &a, 8);
+    }
+    for (; len > 0; --len) *dst++ ^= *src++;
+}
+
+// Scalar fallback and tail handling
+static void mulXorScalar(uint8_t *dst, const uint8_t *src, const uint8_t c, const size_t len) {
+    const GfTables &t = tables();
+    const uint32_t logC = t.log[c];
+    for (size_t i = 0; i < len; ++i) {
+        if (src[i]) dst[i] ^= t.exp[logC + t.log[src[i]]];
+    }
+}
+
+#ifdef GF_X86
+// c * x = c * (x & 0x0F) ^ c * (x & 0xF0), both halves are 16-entry tables that pshufb can look up
+static void nibbleTables(const uint8_t c, uint8_t low[16], uint8_t high[16]) {
+    for (uint8_t i = 0; i < 16; ++i) {
+        low[i] = gfMul(c, i);
+        high[i] = gfMul(c, static_cast<uint8_t>(i << 4));
+    }
+}
+
+__attribute__((target("ssse3")))
+static void mulXorSsse3(uint8_t *dst, const uint8_t *src, const uint8_t c, const size_t len) {
+    alignas(16) uint8_t low[16], high[16];
+    nibbleTables(c, low, high);
+    const __m128i tLow = _mm_load_si128(reinterpret_cast<const __m128i *>(low));
+    const __m128i tHigh = _mm_load_si128(reinterpret_cast<const __m128i *>(high));
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i lo = _mm_shuffle_epi8(tLow, _mm_and_si128(x, mask));
+        const __m128i hi = _mm_shuffle_epi8(tHigh, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(d, _mm_xor_si128(lo, hi)));
+    }
+    mulXorScalar(dst + i, src + i, c, len - i);
+}
+
+__attribute__((target("avx2")))
+static void mulXorAvx2(uint8_t *dst, const uint8_t *src, const uint8_t c, const size_t len) {
+    alignas(16) uint8_t low[16], high[16];
+    nibbleTables(c, low, high);
+    const __m256i tLow = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(low)));
+    const __m256i tHigh = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(high)));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        const __m256i lo = _mm256_shuffle_epi8(tLow, _mm256_and_si256(x, mask));
+        const __m256i hi = _mm256_shuffle_epi8(tHigh, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_xor_si256(d, _mm256_xor_si256(lo, hi)));
+    }
+    mulXorScalar(dst + i, src + i, c, len - i);
+}
+#endif
+
+void gfMulXorInto(uint8_t *dst, const uint8_t *src, const uint8_t c, const size_t len) {
+    if (c == 0) return;
+    if (c == 1) {
+        gfXorInto(dst, src, len);
+        return;
+    }
+#ifdef GF_X86
+    // Picked once, on first use
+    static const auto kernel = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return &mulXorAvx2;
+        if (__builtin_cpu_supports("ssse3")) return &mulXorSsse3;
+        return &mulXorScalar;
+    }();
+    kernel(dst, src, c, len);
+#else
+    mulXorScalar(dst, src, c, len);
+#endif
+}
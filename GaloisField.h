@@ -0,0 +1,22 @@
+//
+// GF(2^8) arithmetic for the parity disks (RAID-6 P+Q)
+// Polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D), generator 2, same as Linux md
+//
+
+#ifndef GALOISFIELD_H
+#define GALOISFIELD_H
+#include    <cstdint>
+#include    <cstddef>
+
+uint8_t gfMul(uint8_t a, uint8_t b);
+uint8_t gfInv(uint8_t a);               // a must not be 0
+uint8_t gfPow2(int32_t n);              // 2^n, n may be negative
+
+// dst ^= src
+void gfXorInto(uint8_t *dst, const uint8_t *src, size_t len);
+
+// dst ^= c * src
+// Uses AVX2 or SSSE3 nibble table lookups (pshufb) when the CPU has them
+void gfMulXorInto(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+
+#endif //GALOISFIELD_H
@@ -0,0 +1,158 @@
+// Heat.cpp
+// The count-min sketch behind dheat and the .heat sidecar files
+#include "Heat.h"
+#include "Trace.h"
+#include "Profile.h"
+#include <sstream>
+#include <fstream>
+#include <fcntl.h>     // for open()
+#include <unistd.h>    // for close()
+#include <sys/file.h>  // for flock()
+
+using namespace std;
+
+static uint32_t sampleOneIn = 0;
+
+void enableHeatSampling(const uint32_t oneIn) {
+    sampleOneIn = oneIn;
+}
+
+uint32_t heatSampling() {
+    return sampleOneIn;
+}
+
+uint64_t heatFileKey(const std::string &name) {
+    return traceHash(name);
+}
+
+uint64_t heatChunkKey(const uint32_t chunk) {
+    return 0x8000000000000000ULL | chunk;   // Out of the way of (most) name hashes
+}
+
+// splitmix64 finalizer, a different column per row
+static uint32_t column(const uint64_t key, const uint32_t row) {
+    uint64_t x = key + (row + 1) * 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast<uint32_t>((x ^ (x >> 31)) & (HEAT_WIDTH - 1));
+}
+
+void HeatCounts::add(const uint64_t key, const uint64_t count) {
+    for (uint32_t row = 0; row < HEAT_DEPTH; ++row) cells[row * HEAT_WIDTH + column(key, row)] += count;
+}
+
+uint64_t HeatCounts::estimate(const uint64_t key) const {
+    uint64_t least = UINT64_MAX;
+    for (uint32_t row = 0; row < HEAT_DEPTH; ++row) least = min(least, cells[row * HEAT_WIDTH + column(key, row)]);
+    return least;
+}
+
+void HeatCounts::merge(const HeatCounts &other) {
+    for (size_t i = 0; i < cells.size(); ++i) cells[i] += other.cells[i];
+    total += other.total;
+    decays = max(decays, other.decays);
+}
+
+HeatSketch::HeatSketch() {
+    if (sampleOneIn != 0) cells = make_unique<atomic<uint64_t>[]>(HEAT_DEPTH * HEAT_WIDTH);
+}
+
+// Accesses until the next sample, drawn around the rate so regular access patterns don't alias with it
+static uint32_t nextGap() {
+    static thread_local uint64_t state = 0x2545f4914f6cdd1dULL ^ reinterpret_cast<uintptr_t>(&state);
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return sampleOneIn == 1 ? 1 : 1 + static_cast<uint32_t>(state % (2 * sampleOneIn - 1));
+}
+
+void HeatSketch::sample(const std::string &file, const std::vector<int32_t> &blocks) noexcept {
+    if (!cells) return;
+    static thread_local uint32_t untilNext = nextGap();
+    uint64_t fileKey = 0;
+    bool haveKey = false;
+    for (const int32_t blk: blocks) {
+        if (--untilNext != 0) continue;
+        untilNext = nextGap();
+        if (!haveKey) {
+            fileKey = heatFileKey(file);
+            haveKey = true;
+        }
+        for (const uint64_t key: {fileKey, heatChunkKey(blk / HEAT_CHUNK_BLOCKS)}) {
+            for (uint32_t row = 0; row < HEAT_DEPTH; ++row) {
+                cells[row * HEAT_WIDTH + column(key, row)].fetch_add(sampleOneIn, memory_order_relaxed);
+            }
+        }
+        total.fetch_add(sampleOneIn, memory_order_relaxed);
+    }
+}
+
+HeatCounts HeatSketch::snapshot() const {
+    HeatCounts counts;
+    if (!cells) return counts;
+    for (size_t i = 0; i < counts.cells.size(); ++i) counts.cells[i] = cells[i].load(memory_order_relaxed);
+    counts.total = total.load(memory_order_relaxed);
+    return counts;
+}
+
+// Format: magic line, "<total> <decays>", then the non-zero cells as <index>:<count>
+static bool parseHeat(istream &in, HeatCounts &counts) {
+    if (!(in >> counts.total >> counts.decays)) return false;
+    uint32_t index;
+    char colon;
+    uint64_t count;
+    while (in >> index >> colon >> count) {
+        if (index < counts.cells.size()) counts.cells[index] += count;
+    }
+    return true;
+}
+
+bool readHeatFile(const std::string &path, HeatCounts &counts) {
+    ifstream in(path);
+    string magic;
+    if (!in || !getline(in, magic) || magic != HEAT_MAGIC) return false;
+    counts = HeatCounts();
+    return parseHeat(in, counts);
+}
+
+bool addToHeatFile(const std::string &path, const HeatCounts &counts) {
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    bool locked;
+    {
+        PROFILE_SPAN("heat file lock", "wait");
+        locked = flock(fd, LOCK_EX) == 0;
+    }
+    if (!locked) {
+        close(fd);
+        return false;
+    }
+
+    string text;
+    char chunk[4096];
+    ssize_t got;
+    while ((got = read(fd, chunk, sizeof(chunk))) > 0) text.append(chunk, got);
+    HeatCounts total = counts;
+    if (istringstream in(text); text.rfind(string(HEAT_MAGIC) + "\n", 0) == 0) {
+        string magic;
+        getline(in, magic);
+        HeatCounts old;
+        if (parseHeat(in, old)) total.merge(old);
+    }
+    while (total.total > HEAT_DECAY_TOTAL) {
+        for (uint64_t &cell: total.cells) cell /= 2;
+        total.total /= 2;
+        ++total.decays;
+    }
+
+    ostringstream out;
+    out << HEAT_MAGIC << "\n" << total.total << " " << total.decays << "\n";
+    for (size_t i = 0; i < total.cells.size(); ++i) {
+        if (total.cells[i] != 0) out << i << ":" << total.cells[i] << "\n";
+    }
+    text = out.str();
+    const bool ok = ftruncate(fd, 0) == 0 && pwrite(fd, text.data(), text.size(), 0) ==
+                    static_cast<ssize_t>(text.size());
+    close(fd);  // Releases the lock
+    return ok;
+}
@@ -0,0 +1,70 @@
+//
+// Block access heat for dheat: with --heat-sample=<n>, about one data block access in n is counted,
+// under its file and under its 64-block chunk of the disk, in a count-min sketch
+// Every disk keeps its own sketch, added to <diskfile>.heat when it is closed
+// Off by default, then sampling is one branch per read or write
+//
+
+#ifndef HEAT_H
+#define HEAT_H
+#include    <string>
+#include    <vector>
+#include    <cstdint>
+#include    <atomic>
+#include    <memory>
+
+// 4 rows of 2048 counters: an estimate is at most e/2048 (0.13%) of all samples too high,
+// except with probability e^-4 (under 2%)
+static constexpr uint32_t HEAT_DEPTH = 4;
+static constexpr uint32_t HEAT_WIDTH = 2048;
+static constexpr uint32_t HEAT_CHUNK_BLOCKS = 64;           // Blocks per heatmap cell
+static constexpr uint64_t HEAT_DECAY_TOTAL = 1ULL << 24;    // Counters are halved when the file gets past this
+static constexpr char HEAT_MAGIC[8] = "TTheat1";            // First line of a .heat file
+static constexpr char HEAT_SUFFIX[] = ".heat";              // Appended to the disk file name
+
+// Sample one in oneIn data block accesses from now on (1 counts all of them)
+void enableHeatSampling(uint32_t oneIn);
+
+// The sampling rate, 0 when off
+uint32_t heatSampling();
+
+// Sketch keys of a file (by name) and of a chunk of blocks
+uint64_t heatFileKey(const std::string &name);
+uint64_t heatChunkKey(uint32_t chunk);
+
+// A plain copy of the sketch
+struct HeatCounts {
+    std::vector<uint64_t> cells = std::vector<uint64_t>(HEAT_DEPTH * HEAT_WIDTH);
+    uint64_t total = 0;         // Block accesses, sampled ones times the rate
+    uint32_t decays = 0;        // Times the counters were halved
+
+    void add(uint64_t key, uint64_t count);
+    uint64_t estimate(uint64_t key) const;  // Never too low
+    void merge(const HeatCounts &other);
+};
+
+// The live sketch of a disk, filled by any thread without locks
+class HeatSketch {
+public:
+    HeatSketch();
+
+    // Data blocks of a file that were read or written
+    void sample(const std::string &file, const std::vector<int32_t> &blocks) noexcept;
+
+    bool empty() const { return total.load(std::memory_order_relaxed) == 0; }
+
+    HeatCounts snapshot() const;
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> cells;    // Only allocated when sampling
+    std::atomic<uint64_t> total{0};
+};
+
+// Read a .heat file, false if it's missing or not one
+bool readHeatFile(const std::string &path, HeatCounts &counts);
+
+// Add counts to the .heat file (created if needed) under an exclusive lock, halving every counter
+// once the total gets past HEAT_DECAY_TOTAL so old accesses fade out
+bool addToHeatFile(const std::string &path, const HeatCounts &counts);
+
+#endif //HEAT_H
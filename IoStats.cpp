@@ -0,0 +1,119 @@
+// IoStats.cpp
+// Counters behind --io-stats and the summary printed at exit
+#include "IoStats.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <mutex>
+#include <cstdlib>     // for atexit()
+
+using namespace std;
+
+namespace {
+    struct RegionCounters {
+        uint64_t reads = 0, writes = 0;             // Stream calls
+        uint64_t bytesRead = 0, bytesWritten = 0;
+        uint64_t seeks = 0, seekBytes = 0;          // Accesses not continuing where the last one ended, and how far
+    };
+
+    // Syscall counters of this process from /proc/self/io, zeros where that isn't available
+    struct ProcIo {
+        uint64_t syscr = 0, syscw = 0, rchar = 0, wchar = 0;
+    };
+
+    bool enabled = false;
+    mutex counterLock;                          // Member files are transferred from several threads
+    RegionCounters regions[IO_REGIONS];
+    uint64_t logicalRead = 0, logicalWritten = 0;
+    ProcIo atStart;
+}
+
+static ProcIo readProcIo() {
+    ProcIo io;
+    ifstream in("/proc/self/io");
+    string key;
+    uint64_t value;
+    while (in >> key >> value) {
+        if (key == "syscr:") io.syscr = value;
+        else if (key == "syscw:") io.syscw = value;
+        else if (key == "rchar:") io.rchar = value;
+        else if (key == "wchar:") io.wchar = value;
+    }
+    return io;
+}
+
+static void printIoStats() {
+    const ProcIo atEnd = readProcIo();
+    const lock_guard guard(counterLock);
+    const char *names[IO_REGIONS] = {"super", "dir", "fat", "tables", "data"};
+    RegionCounters total;
+    uint64_t metadataWritten = 0;
+    cerr << "\nI/O statistics\n";
+    cerr << left << setw(8) << "Region" << right << setw(10) << "Reads" << setw(12) << "Read KB" << setw(10)
+            << "Writes" << setw(12) << "Written KB" << setw(10) << "Seeks" << setw(14) << "Seek KB" << "\n";
+    cerr << string(76, '-') << "\n";
+    cerr << fixed << setprecision(1);
+    for (uint32_t r = 0; r < IO_REGIONS; ++r) {
+        const RegionCounters &c = regions[r];
+        cerr << left << setw(8) << names[r] << right << setw(10) << c.reads << setw(12) << c.bytesRead / 1024.0
+                << setw(10) << c.writes << setw(12) << c.bytesWritten / 1024.0 << setw(10) << c.seeks
+                << setw(14) << c.seekBytes / 1024.0 << "\n";
+        total.reads += c.reads;
+        total.writes += c.writes;
+        total.bytesRead += c.bytesRead;
+        total.bytesWritten += c.bytesWritten;
+        total.seeks += c.seeks;
+        total.seekBytes += c.seekBytes;
+        if (r != IO_DATA) metadataWritten += c.bytesWritten;
+    }
+    cerr << left << setw(8) << "total" << right << setw(10) << total.reads << setw(12) << total.bytesRead / 1024.0
+            << setw(10) << total.writes << setw(12) << total.bytesWritten / 1024.0 << setw(10) << total.seeks
+            << setw(14) << total.seekBytes / 1024.0 << "\n";
+
+    // Amplification: bytes that reached the disk files per byte of file data
+    if (logicalWritten > 0) {
+        cerr << "Write amplification: " << setprecision(2)
+                << static_cast<double>(total.bytesWritten) / logicalWritten << "x (" << logicalWritten
+                << " bytes of file data, " << metadataWritten << " bytes of metadata)\n";
+    }
+    if (logicalRead > 0) {
+        cerr << "Read amplification: " << setprecision(2) << static_cast<double>(total.bytesRead) / logicalRead
+                << "x (" << logicalRead << " bytes of file data)\n";
+    }
+    // The stream calls above are buffered by the C++ library, the kernel saw these (host files included)
+    cerr << "Syscalls: " << atEnd.syscr - atStart.syscr << " reads (" << atEnd.rchar - atStart.rchar << " bytes), "
+            << atEnd.syscw - atStart.syscw << " writes (" << atEnd.wchar - atStart.wchar << " bytes)\n";
+}
+
+void enableIoStats() {
+    if (enabled) return;
+    enabled = true;
+    atStart = readProcIo();
+    atexit(printIoStats);
+}
+
+void ioAccount(IoCursor &cursor, const IoRegion region, const bool write, const uint64_t offset, const uint64_t bytes,
+               const uint32_t calls) {
+    if (!enabled) return;
+    const lock_guard guard(counterLock);
+    RegionCounters &c = regions[region];
+    if (write) {
+        c.writes += calls;
+        c.bytesWritten += bytes;
+    } else {
+        c.reads += calls;
+        c.bytesRead += bytes;
+    }
+    if (offset != cursor.position) {
+        ++c.seeks;
+        c.seekBytes += offset > cursor.position ? offset - cursor.position : cursor.position - offset;
+    }
+    cursor.position = offset + bytes;
+}
+
+void ioLogical(const bool write, const uint64_t bytes) {
+    if (!enabled) return;
+    const lock_guard guard(counterLock);
+    (write ? logicalWritten : logicalRead) += bytes;
+}
@@ -0,0 +1,37 @@
+//
+// I/O accounting for --io-stats: requests, bytes and seeks per region of the disk, and how many
+// bytes reach the files for every byte of file data asked for
+// Off unless enableIoStats() was called, then the summary is printed when the program exits
+//
+
+#ifndef IOSTATS_H
+#define IOSTATS_H
+#include    <cstdint>
+
+// Where in a disk an access lands
+enum IoRegion : uint32_t {
+    IO_SUPERBLOCK,
+    IO_DIRECTORY,
+    IO_FAT,
+    IO_TABLES,      // Overlay block map, mirror checksums, tier table
+    IO_DATA,        // Data blocks, in the disk file or its members
+    IO_REGIONS
+};
+
+// Start counting, and print the summary to stderr at exit
+void enableIoStats();
+
+// Where the last access to one file ended, kept by whoever owns the stream or descriptor
+// A new cursor is at 0, so a file's first access counts as a seek from its start
+struct IoCursor {
+    uint64_t position = 0;
+};
+
+// An access of 'bytes' at 'offset' of a file, made with 'calls' stream calls
+// An access not starting where the file's cursor is is a seek, the cursor then moves past it
+void ioAccount(IoCursor &cursor, IoRegion region, bool write, uint64_t offset, uint64_t bytes, uint32_t calls = 1);
+
+// File data a command asked to write or read, before any padding, metadata or redundancy
+void ioLogical(bool write, uint64_t bytes);
+
+#endif //IOSTATS_H
@@ -0,0 +1,192 @@
+// Metrics.cpp
+// Latency histograms and the .stats sidecar files
+#include "Metrics.h"
+#include "Profile.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fcntl.h>     // for open()
+#include <unistd.h>    // for close()
+#include <sys/file.h>  // for flock()
+
+using namespace std;
+
+const char *metricName(const MetricOp op) {
+    static const char *names[METRIC_OPS] = {"put", "get", "delete", "list", "flush", "alloc", "lock"};
+    return op < METRIC_OPS ? names[op] : "?";
+}
+
+uint32_t histBucket(const uint64_t ns) {
+    constexpr uint64_t sub = 1 << HIST_SUB_BITS;
+    if (ns < sub) return static_cast<uint32_t>(ns);
+    const uint32_t exponent = 63 - countl_zero(ns);
+    const uint32_t bucket = ((exponent - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+                            static_cast<uint32_t>((ns >> (exponent - HIST_SUB_BITS)) & (sub - 1));
+    return min(bucket, HIST_BUCKETS - 1);
+}
+
+uint64_t histBucketLow(const uint32_t bucket) {
+    constexpr uint64_t sub = 1 << HIST_SUB_BITS;
+    if (bucket < sub) return bucket;
+    const uint32_t exponent = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    return (sub + (bucket & (sub - 1))) << (exponent - HIST_SUB_BITS);
+}
+
+void OpMetrics::merge(const OpMetrics &other) {
+    count += other.count;
+    errors += other.errors;
+    bytes += other.bytes;
+    totalNs += other.totalNs;
+    maxNs = max(maxNs, other.maxNs);
+    for (uint32_t i = 0; i < HIST_BUCKETS; ++i) buckets[i] += other.buckets[i];
+}
+
+uint64_t OpMetrics::percentile(const double q) const {
+    if (count == 0) return 0;
+    const auto rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HIST_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            // Middle of the bucket, never past the slowest call seen
+            const uint64_t low = histBucketLow(i);
+            const uint64_t high = i + 1 < HIST_BUCKETS ? histBucketLow(i + 1) : low;
+            return min(low + (high - low) / 2, maxNs);
+        }
+    }
+    return maxNs;
+}
+
+void MetricsSnapshot::merge(const MetricsSnapshot &other) {
+    for (uint32_t op = 0; op < METRIC_OPS; ++op) ops[op].merge(other.ops[op]);
+}
+
+bool MetricsSnapshot::empty() const {
+    return all_of(ops.begin(), ops.end(), [](const OpMetrics &op) { return op.count == 0; });
+}
+
+Metrics::Shard &Metrics::shardForThread() noexcept {
+    static atomic<uint32_t> nextSlot{0};
+    static thread_local const uint32_t slot = nextSlot.fetch_add(1, memory_order_relaxed) % METRIC_SHARDS;
+    Shard *shard = shards[slot].load(memory_order_acquire);
+    if (shard == nullptr) {
+        auto fresh = make_unique<Shard>();
+        if (shards[slot].compare_exchange_strong(shard, fresh.get(), memory_order_acq_rel)) {
+            shard = fresh.get();
+            owned[slot] = std::move(fresh);
+        }
+        // else another thread with the same slot won, shard now holds its one
+    }
+    return *shard;
+}
+
+void Metrics::record(const MetricOp op, const uint64_t ns, const uint64_t bytes, const bool failed) noexcept {
+    Shard::Op &counters = shardForThread().ops[op];
+    counters.count.fetch_add(1, memory_order_relaxed);
+    if (failed) counters.errors.fetch_add(1, memory_order_relaxed);
+    counters.bytes.fetch_add(bytes, memory_order_relaxed);
+    counters.totalNs.fetch_add(ns, memory_order_relaxed);
+    counters.buckets[histBucket(ns)].fetch_add(1, memory_order_relaxed);
+    uint64_t seen = counters.maxNs.load(memory_order_relaxed);
+    while (ns > seen && !counters.maxNs.compare_exchange_weak(seen, ns, memory_order_relaxed)) {
+    }
+}
+
+MetricsSnapshot Metrics::snapshot() const {
+    MetricsSnapshot snapshot;
+    for (const auto &slot: shards) {
+        const Shard *shard = slot.load(memory_order_acquire);
+        if (shard == nullptr) continue;
+        for (uint32_t op = 0; op < METRIC_OPS; ++op) {
+            const Shard::Op &counters = shard->ops[op];
+            OpMetrics &sum = snapshot.ops[op];
+            sum.count += counters.count.load(memory_order_relaxed);
+            sum.errors += counters.errors.load(memory_order_relaxed);
+            sum.bytes += counters.bytes.load(memory_order_relaxed);
+            sum.totalNs += counters.totalNs.load(memory_order_relaxed);
+            sum.maxNs = max(sum.maxNs, counters.maxNs.load(memory_order_relaxed));
+            for (uint32_t i = 0; i < HIST_BUCKETS; ++i) sum.buckets[i] += counters.buckets[i].load(memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+MetricTimer::~MetricTimer() {
+    const auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    metrics.record(op, static_cast<uint64_t>(ns), bytes, !ok);
+}
+
+// Line format: <op> <count> <errors> <bytes> <total_ns> <max_ns> [<bucket>:<calls> ...]
+static void parseStats(istream &in, MetricsSnapshot &snapshot) {
+    string line;
+    while (getline(in, line)) {
+        istringstream fields(line);
+        string name;
+        OpMetrics op;
+        if (!(fields >> name >> op.count >> op.errors >> op.bytes >> op.totalNs >> op.maxNs)) continue;
+        uint32_t bucket;
+        char colon;
+        uint64_t calls;
+        while (fields >> bucket >> colon >> calls) {
+            if (bucket < HIST_BUCKETS) op.buckets[bucket] += calls;
+        }
+        for (uint32_t i = 0; i < METRIC_OPS; ++i) {
+            if (name == metricName(static_cast<MetricOp>(i))) snapshot.ops[i].merge(op);
+        }
+    }
+}
+
+bool readStatsFile(const std::string &path, MetricsSnapshot &snapshot) {
+    ifstream in(path);
+    string magic;
+    if (!in || !getline(in, magic) || magic != STATS_MAGIC) return false;
+    snapshot = MetricsSnapshot();
+    parseStats(in, snapshot);
+    return true;
+}
+
+bool addToStatsFile(const std::string &path, const MetricsSnapshot &snapshot) {
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    bool locked;
+    {
+        PROFILE_SPAN("stats file lock", "wait");
+        locked = flock(fd, LOCK_EX) == 0;
+    }
+    if (!locked) {
+        close(fd);
+        return false;
+    }
+
+    // Whatever is in the file already, a file from something else is overwritten
+    string text;
+    char chunk[4096];
+    ssize_t got;
+    while ((got = read(fd, chunk, sizeof(chunk))) > 0) text.append(chunk, got);
+    MetricsSnapshot total = snapshot;
+    if (istringstream in(text); text.rfind(string(STATS_MAGIC) + "\n", 0) == 0) {
+        string magic;
+        getline(in, magic);
+        parseStats(in, total);
+    }
+
+    ostringstream out;
+    out << STATS_MAGIC << "\n";
+    for (uint32_t i = 0; i < METRIC_OPS; ++i) {
+        const OpMetrics &op = total.ops[i];
+        out << metricName(static_cast<MetricOp>(i)) << " " << op.count << " " << op.errors << " " << op.bytes << " "
+                << op.totalNs << " " << op.maxNs;
+        for (uint32_t bucket = 0; bucket < HIST_BUCKETS; ++bucket) {
+            if (op.buckets[bucket] != 0) out << " " << bucket << ":" << op.buckets[bucket];
+        }
+        out << "\n";
+    }
+    text = out.str();
+    const bool ok = ftruncate(fd, 0) == 0 && pwrite(fd, text.data(), text.size(), 0) ==
+                    static_cast<ssize_t>(text.size());
+    close(fd);  // Releases the lock
+    return ok;
+}
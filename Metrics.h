@@ -0,0 +1,116 @@
+//
+// Per-operation counters and latency histograms, cheap enough to be always on
+// Every disk keeps its own, they are added to <diskfile>.stats when it is closed
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+#include    <string>
+#include    <cstdint>
+#include    <array>
+#include    <atomic>
+#include    <chrono>
+#include    <memory>
+
+// Measured operations
+enum MetricOp : uint32_t {
+    METRIC_PUT,         // dput, and the receiving side of dcp
+    METRIC_GET,         // dget, and the sending side of dcp
+    METRIC_DELETE,      // ddel
+    METRIC_LIST,        // dls
+    METRIC_FLUSH,       // Directory or FAT written back
+    METRIC_ALLOC,       // Free block search
+    METRIC_LOCK,        // Waits for the disk lock in loadDisk, a lock taken at once is not counted
+    METRIC_OPS
+};
+
+// Log-linear (HDR-style) latency buckets: 8 per power of two, so a bucket is at most 12.5% wide,
+// from 1 ns up to 2^43 ns (about 2.5 hours), anything slower lands in the last bucket
+static constexpr uint32_t HIST_SUB_BITS = 3;
+static constexpr uint32_t HIST_BUCKETS = (43 - HIST_SUB_BITS + 1) << HIST_SUB_BITS;
+
+static constexpr uint32_t METRIC_SHARDS = 8;        // Threads past this many share shards
+static constexpr char STATS_MAGIC[8] = "TTsts01";   // First line of a .stats file
+static constexpr char STATS_SUFFIX[] = ".stats";    // Appended to the disk file name
+
+// One operation's numbers, merged from all shards
+struct OpMetrics {
+    uint64_t count = 0;         // Calls, failed ones included
+    uint64_t errors = 0;        // Calls that failed
+    uint64_t bytes = 0;         // File bytes moved, bytes written for flushes, bytes asked for for allocations
+    uint64_t totalNs = 0;
+    uint64_t maxNs = 0;
+    std::array<uint64_t, HIST_BUCKETS> buckets{};
+
+    void merge(const OpMetrics &other);
+    uint64_t percentile(double q) const;    // Latency in ns below which a q (0..1) share of the calls fall
+};
+
+struct MetricsSnapshot {
+    std::array<OpMetrics, METRIC_OPS> ops{};
+
+    void merge(const MetricsSnapshot &other);
+    bool empty() const;
+};
+
+// Short name of an operation, as used in .stats files and by dstats
+const char *metricName(MetricOp op);
+
+uint32_t histBucket(uint64_t ns);       // Bucket a latency falls in
+uint64_t histBucketLow(uint32_t bucket); // Smallest latency of a bucket
+
+// The live counters of one disk
+// Each thread records into its own shard (picked once per thread), so recording never takes a lock
+// and threads don't fight over cache lines; reading adds all shards up
+class Metrics {
+public:
+    void record(MetricOp op, uint64_t ns, uint64_t bytes, bool failed) noexcept;
+    MetricsSnapshot snapshot() const;
+
+private:
+    struct alignas(64) Shard {
+        struct Op {
+            std::atomic<uint64_t> count{0}, errors{0}, bytes{0}, totalNs{0}, maxNs{0};
+            std::array<std::atomic<uint64_t>, HIST_BUCKETS> buckets{};
+        };
+
+        std::array<Op, METRIC_OPS> ops;
+    };
+
+    // Allocated on a thread's first record, most disks only ever see one thread
+    std::array<std::atomic<Shard *>, METRIC_SHARDS> shards{};
+    std::array<std::unique_ptr<Shard>, METRIC_SHARDS> owned;   // Frees the shards
+
+    Shard &shardForThread() noexcept;
+};
+
+// Times one operation from construction to destruction, recorded as failed unless done() was called
+class MetricTimer {
+public:
+    MetricTimer(Metrics &metrics, MetricOp op) : metrics(metrics), op(op), start(std::chrono::steady_clock::now()) {
+    }
+
+    ~MetricTimer();
+
+    MetricTimer(const MetricTimer &) = delete;
+    MetricTimer &operator=(const MetricTimer &) = delete;
+
+    void done(const uint64_t movedBytes = 0) {
+        bytes = movedBytes;
+        ok = true;
+    }
+
+private:
+    Metrics &metrics;
+    MetricOp op;
+    std::chrono::steady_clock::time_point start;
+    uint64_t bytes = 0;
+    bool ok = false;
+};
+
+// .stats files: one text line per operation, only non-empty buckets are written
+bool readStatsFile(const std::string &path, MetricsSnapshot &snapshot);
+// Add a snapshot to a .stats file, under a lock so processes closing the same disk don't lose counts
+bool addToStatsFile(const std::string &path, const MetricsSnapshot &snapshot);
+
+#endif //METRICS_H
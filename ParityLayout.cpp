@@ -0,0 +1,239 @@
+// ParityLayout.cpp
+// Parity disks: rows of (members - parityCount) data units plus a P unit (XOR) and,
+// for RAID-6, a Q unit (sum of 2^column * data in GF(2^8)). Parity rotates over the members
+#include "VirtualFileSystem.h"
+#include "GaloisField.h"
+#include <iostream>
+#include <cstring>
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+// Member holding a column of a row. Columns 0..K-1 are data, K is P, K+1 is Q
+uint32_t VirtualFileSystem::parityMember(const uint32_t row, const uint32_t column) const {
+    const uint32_t dataColumns = sb.memberCount - sb.parityCount;
+    if (column < dataColumns) return (row + sb.parityCount + column) % sb.memberCount;
+    return (row + column - dataColumns) % sb.memberCount;
+}
+
+// Recompute the parity columns of a row from its data columns
+static void computeParity(uint8_t *row, const size_t unitBytes, const uint32_t dataColumns, const uint32_t parity) {
+    uint8_t *p = row + dataColumns * unitBytes;
+    memcpy(p, row, unitBytes);
+    for (uint32_t c = 1; c < dataColumns; ++c) gfXorInto(p, row + c * unitBytes, unitBytes);
+    if (parity < 2) return;
+    uint8_t *q = p + unitBytes;
+    memset(q, 0, unitBytes);
+    for (uint32_t c = 0; c < dataColumns; ++c) gfMulXorInto(q, row + c * unitBytes, gfPow2(static_cast<int32_t>(c)), unitBytes);
+}
+
+// Rebuild lost columns of a row from the surviving ones, at most 'parity' columns can be lost
+static bool rebuildColumns(uint8_t *row, const size_t unitBytes, const uint32_t dataColumns, const uint32_t parity,
+                           const vector<uint32_t> &lost) {
+    vector<uint32_t> lostData;
+    bool lostP = false, lostQ = false;
+    for (const uint32_t c: lost) {
+        if (c < dataColumns) lostData.push_back(c);
+        else if (c == dataColumns) lostP = true;
+        else lostQ = true;
+    }
+    auto column = [&](const uint32_t c) { return row + c * unitBytes; };
+    uint8_t *p = column(dataColumns);
+    uint8_t *q = column(dataColumns + 1);
+    vector<uint8_t> partial(unitBytes), scratch(unitBytes);
+
+    if (lostData.size() == 1 && !lostP) {
+        // D_x = P ^ the other data columns
+        const uint32_t x = lostData[0];
+        memcpy(column(x), p, unitBytes);
+        for (uint32_t c = 0; c < dataColumns; ++c) {
+            if (c != x) gfXorInto(column(x), column(c), unitBytes);
+        }
+    } else if (lostData.size() == 1 && parity == 2 && !lostQ) {
+        // D_x = (Q ^ sum of 2^c * D_c over the other columns) / 2^x
+        const uint32_t x = lostData[0];
+        memcpy(partial.data(), q, unitBytes);
+        for (uint32_t c = 0; c < dataColumns; ++c) {
+            if (c != x) gfMulXorInto(partial.data(), column(c), gfPow2(static_cast<int32_t>(c)), unitBytes);
+        }
+        memset(column(x), 0, unitBytes);
+        gfMulXorInto(column(x), partial.data(), gfPow2(-static_cast<int32_t>(x)), unitBytes);
+    } else if (lostData.size() == 2 && parity == 2 && !lostP && !lostQ) {
+        // With Pxy = D_x ^ D_y and Qxy = 2^x D_x ^ 2^y D_y:
+        // D_x = A * Pxy ^ B * Qxy, A = 2^(y-x) / (2^(y-x) ^ 1), B = 2^-x / (2^(y-x) ^ 1), D_y = Pxy ^ D_x
+        const auto x = static_cast<int32_t>(lostData[0]), y = static_cast<int32_t>(lostData[1]);
+        memcpy(partial.data(), p, unitBytes);
+        memcpy(scratch.data(), q, unitBytes);
+        for (uint32_t c = 0; c < dataColumns; ++c) {
+            if (c == lostData[0] || c == lostData[1]) continue;
+            gfXorInto(partial.data(), column(c), unitBytes);
+            gfMulXorInto(scratch.data(), column(c), gfPow2(static_cast<int32_t>(c)), unitBytes);
+        }
+        const uint8_t denominator = gfInv(gfPow2(y - x) ^ 1);
+        const uint8_t a = gfMul(gfPow2(y - x), denominator);
+        const uint8_t b = gfMul(gfPow2(-x), denominator);
+        memset(column(x), 0, unitBytes);
+        gfMulXorInto(column(x), partial.data(), a, unitBytes);
+        gfMulXorInto(column(x), scratch.data(), b, unitBytes);
+        memcpy(column(y), partial.data(), unitBytes);
+        gfXorInto(column(y), column(x), unitBytes);
+    } else if (!lostData.empty()) {
+        return false;
+    }
+    // Lost parity is simply recomputed
+    if (lostP || lostQ) computeParity(row, unitBytes, dataColumns, parity);
+    return true;
+}
+
+// Read whole rows into 'staging' (row after row, every column stripeBlocks blocks long),
+// rebuilding the columns of missing or failing members
+// With dataOnly and all members healthy, only the data columns are read
+bool VirtualFileSystem::readParityRows(const vector<uint32_t> &rows, char *staging, const bool dataOnly) {
+    const uint32_t members = sb.memberCount, unit = sb.stripeBlocks;
+    const uint32_t dataColumns = members - sb.parityCount;
+    vector<char> lost(memberMissing);
+    bool degraded = any_of(lost.begin(), lost.end(), [](const char l) { return l != 0; });
+
+    bool readAll = !dataOnly || degraded;
+    while (true) {
+        vector<vector<pair<uint64_t, size_t> > > runs(members);
+        for (size_t slot = 0; slot < rows.size(); ++slot) {
+            for (uint32_t c = 0; c < (readAll ? members : dataColumns); ++c) {
+                const uint32_t m = parityMember(rows[slot], c);
+                if (lost[m]) continue;
+                for (uint32_t off = 0; off < unit; ++off) {
+                    runs[m].emplace_back(static_cast<uint64_t>(rows[slot]) * unit + off, (slot * members + c) * unit + off);
+                }
+            }
+        }
+        const vector<char> ok = transferMembers(runs, staging, false);
+        bool failed = false;
+        for (uint32_t m = 0; m < members; ++m) {
+            if (ok[m]) continue;
+            memberFiles[m].clear();
+            cerr << "Warning: Read from member '" << sb.members[m] << "' failed, rebuilding from parity\n";
+            lost[m] = 1;
+            failed = true;
+        }
+        degraded = degraded || failed;
+        // A member failing mid-way means the parity columns are needed after all
+        if (!failed || readAll) break;
+        readAll = true;
+    }
+    if (!degraded) return true;
+
+    vector<uint32_t> lostColumns;
+    for (size_t slot = 0; slot < rows.size(); ++slot) {
+        lostColumns.clear();
+        for (uint32_t c = 0; c < members; ++c) {
+            if (lost[parityMember(rows[slot], c)]) lostColumns.push_back(c);
+        }
+        if (lostColumns.size() > sb.parityCount ||
+            !rebuildColumns(reinterpret_cast<uint8_t *>(staging) + slot * members * unit * BLOCK_SIZE,
+                            static_cast<size_t>(unit) * BLOCK_SIZE, dataColumns, sb.parityCount, lostColumns)) {
+            cerr << "Error: Too many members lost to rebuild row " << rows[slot] << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Read a batch from a parity disk
+// Blocks are read straight from their members; only rows with a block on a missing or failing
+// member are read completely and rebuilt
+bool VirtualFileSystem::readParity(const vector<int32_t> &blocks, char *buffer) {
+    const uint32_t members = sb.memberCount, unit = sb.stripeBlocks;
+    const uint32_t dataColumns = members - sb.parityCount;
+
+    vector<vector<pair<uint64_t, size_t> > > runs(members);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        const auto [member, index] = locateBlock(blocks[i]);
+        if (!memberMissing[member]) runs[member].emplace_back(index, i);
+    }
+    const vector<char> ok = transferMembers(runs, buffer, false);
+
+    map<uint32_t, vector<size_t> > degradedRows;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        const uint32_t member = locateBlock(blocks[i]).first;
+        if (memberMissing[member] || !ok[member]) {
+            degradedRows[(blocks[i] - sb.dataStartBlock) / unit / dataColumns].push_back(i);
+        }
+    }
+    if (degradedRows.empty()) return true;
+
+    vector<uint32_t> rows;
+    for (const auto &row: degradedRows) rows.push_back(row.first);
+    vector<char> staging(rows.size() * members * unit * BLOCK_SIZE);
+    if (!readParityRows(rows, staging.data(), false)) return false;
+    for (size_t slot = 0; slot < rows.size(); ++slot) {
+        for (const size_t i: degradedRows[rows[slot]]) {
+            const uint32_t dataBlock = blocks[i] - sb.dataStartBlock;
+            const uint32_t column = dataBlock / unit % dataColumns;
+            memcpy(buffer + i * BLOCK_SIZE,
+                   staging.data() + ((slot * members + column) * unit + dataBlock % unit) * BLOCK_SIZE, BLOCK_SIZE);
+        }
+    }
+    return true;
+}
+
+// Write a batch to a parity disk
+// Rows the batch covers completely (the common case for dput) get their parity straight from the
+// new data. Other rows are read first, so the parity also covers the blocks not being written
+bool VirtualFileSystem::writeParity(const vector<int32_t> &blocks, const char *buffer) {
+    const uint32_t members = sb.memberCount, unit = sb.stripeBlocks;
+    const uint32_t dataColumns = members - sb.parityCount;
+    const size_t unitBytes = static_cast<size_t>(unit) * BLOCK_SIZE;
+
+    map<uint32_t, vector<size_t> > byRow;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        byRow[(blocks[i] - sb.dataStartBlock) / unit / dataColumns].push_back(i);
+    }
+    // Partial rows first, so they fill the first slots of the staging buffer
+    vector<uint32_t> rows;
+    for (const auto &[row, positions]: byRow) {
+        if (positions.size() < static_cast<size_t>(dataColumns) * unit) rows.push_back(row);
+    }
+    const size_t partialRows = rows.size();
+    for (const auto &[row, positions]: byRow) {
+        if (positions.size() == static_cast<size_t>(dataColumns) * unit) rows.push_back(row);
+    }
+
+    vector<char> staging(rows.size() * members * unitBytes);
+    if (partialRows > 0 && !readParityRows({rows.begin(), rows.begin() + partialRows}, staging.data(), true)) {
+        return false;
+    }
+
+    vector<vector<pair<uint64_t, size_t> > > runs(members);
+    for (size_t slot = 0; slot < rows.size(); ++slot) {
+        const uint32_t row = rows[slot];
+        for (const size_t i: byRow[row]) {
+            const uint32_t dataBlock = blocks[i] - sb.dataStartBlock;
+            const uint32_t column = dataBlock / unit % dataColumns;
+            const size_t position = (slot * members + column) * unit + dataBlock % unit;
+            memcpy(staging.data() + position * BLOCK_SIZE, buffer + i * BLOCK_SIZE, BLOCK_SIZE);
+            if (const uint32_t m = parityMember(row, column); !memberMissing[m]) {
+                runs[m].emplace_back(static_cast<uint64_t>(row) * unit + dataBlock % unit, position);
+            }
+        }
+        computeParity(reinterpret_cast<uint8_t *>(staging.data()) + slot * members * unitBytes, unitBytes,
+                      dataColumns, sb.parityCount);
+        for (uint32_t c = dataColumns; c < members; ++c) {
+            const uint32_t m = parityMember(row, c);
+            if (memberMissing[m]) continue;
+            for (uint32_t off = 0; off < unit; ++off) {
+                runs[m].emplace_back(static_cast<uint64_t>(row) * unit + off, (slot * members + c) * unit + off);
+            }
+        }
+    }
+
+    // Still fine as long as no more members are gone than the parity can make up for
+    const vector<char> ok = transferMembers(runs, staging.data(), true);
+    vector<char> lost(members, 0);
+    for (uint32_t m = 0; m < members; ++m) {
+        if (!memberMissing[m] && !ok[m]) cerr << "Warning: Write to member '" << sb.members[m] << "' failed\n";
+        lost[m] = memberMissing[m] || !ok[m];
+    }
+    markStale(lost);
+    return count(lost.begin(), lost.end(), 1) <= static_cast<ptrdiff_t>(sb.parityCount);
+}
@@ -0,0 +1,253 @@
+// Profile.cpp
+// The phase tree behind --profile and the span rings behind --chrome-trace
+#include "Profile.h"
+
+#ifdef VFS_PROFILE
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdlib>     // for atexit()
+#include <cstring>
+#include <ctime>       // for clock_gettime()
+#include <unistd.h>    // for getpid()
+
+using namespace std;
+
+thread_local uint64_t profileAllocCount = 0;
+thread_local uint64_t profileAllocBytes = 0;
+bool profileAllocHooked = false;
+
+struct ProfileNode {
+    explicit ProfileNode(const char *name) : name(name) {
+    }
+
+    const char *name;
+    vector<unique_ptr<ProfileNode> > children;  // In the order they first ran
+    uint64_t calls = 0, wallNs = 0, cpuNs = 0, allocs = 0, heapBytes = 0;
+};
+
+namespace {
+    bool profiling = false;
+    mutex treeLock;                             // Worker threads can run phases too
+    ProfileNode root{"total"};
+    chrono::steady_clock::time_point rootStart;
+    uint64_t rootCpuStart = 0, rootAllocStart = 0, rootAllocBytesStart = 0;
+    thread_local ProfileNode *current = nullptr; // Innermost running phase of this thread, null means the root
+}
+
+// Timeline
+struct SpanEvent {
+    const char *name;
+    const char *category;
+    uint64_t startNs;       // Since the trace started
+    uint64_t durationNs;
+};
+
+// Written only by the thread holding it, so recording takes no lock
+// A thread that ends hands its ring to the next new thread, which then shows up in the same timeline row
+struct SpanRing {
+    uint32_t tid;
+    std::vector<SpanEvent> events = std::vector<SpanEvent>(SPAN_RING_EVENTS);
+    uint64_t written = 0;
+};
+
+namespace {
+    bool timeline = false;
+    string timelinePath;
+    chrono::steady_clock::time_point timelineStart;
+    mutex ringLock;                             // Guards the two lists, not the rings
+    vector<unique_ptr<SpanRing> > rings;
+    vector<SpanRing *> freeRings;
+
+    struct RingHolder {
+        SpanRing *ring = nullptr;
+
+        ~RingHolder() {
+            if (ring == nullptr) return;
+            const lock_guard guard(ringLock);
+            freeRings.push_back(ring);
+        }
+    };
+
+    thread_local RingHolder holder;
+}
+
+static void recordSpan(const char *name, const char *category, const chrono::steady_clock::time_point start) {
+    const auto end = chrono::steady_clock::now();
+    if (holder.ring == nullptr) {
+        const lock_guard guard(ringLock);
+        if (!freeRings.empty()) {
+            holder.ring = freeRings.back();
+            freeRings.pop_back();
+        } else {
+            rings.push_back(make_unique<SpanRing>());
+            rings.back()->tid = static_cast<uint32_t>(rings.size());
+            holder.ring = rings.back().get();
+        }
+    }
+    SpanRing &ring = *holder.ring;
+    ring.events[ring.written++ % SPAN_RING_EVENTS] = {
+        name, category,
+        static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(start - timelineStart).count()),
+        static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(end - start).count())
+    };
+}
+
+static string jsonEscape(const char *text) {
+    string escaped;
+    for (const char *c = text; *c; ++c) {
+        if (*c == '"' || *c == '\\') escaped += '\\';
+        if (static_cast<unsigned char>(*c) >= 0x20) escaped += *c;
+    }
+    return escaped;
+}
+
+// Complete ("X") events, one timeline row per ring, rows named by thread_name metadata events
+static void writeTimeline() {
+    const lock_guard guard(ringLock);
+    ofstream out(timelinePath);
+    if (!out) {
+        cerr << "Warning: Cannot write trace file '" << timelinePath << "'\n";
+        return;
+    }
+    const int pid = getpid();
+    uint64_t dropped = 0;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first = true;
+    out << fixed << setprecision(3);
+    for (const auto &ring: rings) {
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":"
+                << ring->tid << ",\"args\":{\"name\":\""
+                << (ring->tid == 1 ? string("main") : "worker " + to_string(ring->tid - 1)) << "\"}}";
+        first = false;
+        const uint64_t kept = min<uint64_t>(ring->written, SPAN_RING_EVENTS);
+        dropped += ring->written - kept;
+        for (uint64_t i = ring->written - kept; i < ring->written; ++i) {
+            const SpanEvent &event = ring->events[i % SPAN_RING_EVENTS];
+            out << ",\n{\"name\":\"" << jsonEscape(event.name) << "\",\"cat\":\"" << event.category
+                    << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << ring->tid << ",\"ts\":"
+                    << event.startNs / 1e3 << ",\"dur\":" << event.durationNs / 1e3 << "}";
+        }
+    }
+    out << "\n]}\n";
+    if (dropped > 0) {
+        cerr << "Warning: " << dropped << " older spans were overwritten, the trace holds the last "
+                << SPAN_RING_EVENTS << " per thread\n";
+    }
+}
+
+static uint64_t cpuNow(const clockid_t clock) {
+    timespec ts{};
+    clock_gettime(clock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+static void printNode(const ProfileNode &node, const uint32_t depth, const double rootWall) {
+    const string label = string(depth * 2, ' ') + node.name;
+    cerr << left << setw(36) << label << right << setw(8) << node.calls << setw(12) << node.wallNs / 1e6
+            << setw(7) << setprecision(1) << (rootWall > 0 ? 100.0 * node.wallNs / rootWall : 0) << "%"
+            << setw(12) << setprecision(3) << node.cpuNs / 1e6
+            << setw(10);
+    if (profileAllocHooked) {
+        cerr << node.allocs << setw(12) << node.heapBytes / 1024.0 << "\n";
+    } else {
+        cerr << "-" << setw(12) << "-" << "\n";
+    }
+    for (const auto &child: node.children) printNode(*child, depth + 1, rootWall);
+}
+
+static void printProfile() {
+    const lock_guard guard(treeLock);
+    root.calls = 1;
+    root.wallNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - rootStart).count();
+    root.cpuNs = cpuNow(CLOCK_PROCESS_CPUTIME_ID) - rootCpuStart;
+    root.allocs = profileAllocCount - rootAllocStart;
+    root.heapBytes = profileAllocBytes - rootAllocBytesStart;
+    cerr << "\nProfile (wall and CPU in ms, allocations of the thread running the phase)\n";
+    cerr << left << setw(36) << "Phase" << right << setw(8) << "Calls" << setw(12) << "Wall" << setw(8) << "Share"
+            << setw(12) << "CPU" << setw(10) << "Allocs" << setw(12) << "Alloc KB" << "\n";
+    cerr << string(98, '-') << "\n";
+    cerr << fixed << setprecision(3);
+    printNode(root, 0, static_cast<double>(root.wallNs));
+}
+
+bool enableProfile() {
+    if (profiling) return true;
+    profiling = true;
+    rootStart = chrono::steady_clock::now();
+    rootCpuStart = cpuNow(CLOCK_PROCESS_CPUTIME_ID);
+    rootAllocStart = profileAllocCount;
+    rootAllocBytesStart = profileAllocBytes;
+    atexit(printProfile);
+    return true;
+}
+
+bool enableChromeTrace(const std::string &path) {
+    if (timeline) return true;
+    timeline = true;
+    timelinePath = path;
+    timelineStart = chrono::steady_clock::now();
+    atexit(writeTimeline);
+    return true;
+}
+
+ProfileScope::ProfileScope(const char *name) : name(name) {
+    active = profiling || timeline;
+    if (!active) return;
+    if (profiling) {
+        const lock_guard guard(treeLock);
+        parent = current ? current : &root;
+        for (const auto &child: parent->children) {
+            if (strcmp(child->name, name) == 0) node = child.get();
+        }
+        if (node == nullptr) {
+            parent->children.push_back(make_unique<ProfileNode>(name));
+            node = parent->children.back().get();
+        }
+    }
+    if (node != nullptr) current = node;
+    allocStart = profileAllocCount;
+    allocBytesStart = profileAllocBytes;
+    cpuStartNs = cpuNow(CLOCK_THREAD_CPUTIME_ID);
+    wallStart = chrono::steady_clock::now();
+}
+
+ProfileScope::~ProfileScope() {
+    if (!active) return;
+    if (timeline) recordSpan(name, "phase", wallStart);
+    if (node == nullptr) return;
+    const auto wall = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - wallStart).count();
+    const uint64_t cpu = cpuNow(CLOCK_THREAD_CPUTIME_ID) - cpuStartNs;
+    const lock_guard guard(treeLock);
+    ++node->calls;
+    node->wallNs += wall;
+    node->cpuNs += cpu;
+    node->allocs += profileAllocCount - allocStart;
+    node->heapBytes += profileAllocBytes - allocBytesStart;
+    current = parent == &root ? nullptr : parent;
+}
+
+ProfileSpan::ProfileSpan(const char *name, const char *category) : name(name), category(category) {
+    active = timeline;
+    if (active) start = chrono::steady_clock::now();
+}
+
+ProfileSpan::~ProfileSpan() {
+    if (active) recordSpan(name, category, start);
+}
+
+#else
+
+bool enableProfile() {
+    return false;
+}
+
+bool enableChromeTrace(const std::string &) {
+    return false;
+}
+
+#endif
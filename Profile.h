@@ -0,0 +1,82 @@
+//
+// Phase timers for --profile: PROFILE_SCOPE("name") times the rest of the enclosing block as a
+// phase nested in whatever phase is running, and the tree of phases is printed at exit with
+// calls, wall time, CPU time and heap allocations per phase
+// With --chrome-trace=<file> every phase, plus the finer PROFILE_SPAN("name", "category") spans
+// (I/O runs, waits), also goes into a per-thread ring buffer, written out at exit as Chrome
+// trace-event JSON for chrome://tracing or ui.perfetto.dev
+// Built in when VFS_PROFILE is defined (the CMake option of the same name), otherwise the scopes
+// compile to nothing. Heap allocations are only counted in a vfs built with VFS_PROFILE_ALLOC,
+// which links the counting operator new of ProfileAlloc.cpp into the program (never the library)
+//
+
+#ifndef PROFILE_H
+#define PROFILE_H
+#include    <cstdint>
+#include    <string>
+
+// Start collecting, the tree is printed to stderr at exit
+// False if the program was built without VFS_PROFILE
+bool enableProfile();
+
+// Start recording spans, written to path at exit
+// False if the program was built without VFS_PROFILE
+bool enableChromeTrace(const std::string &path);
+
+#ifdef VFS_PROFILE
+#include    <chrono>
+
+static constexpr uint32_t SPAN_RING_EVENTS = 1 << 14;  // Spans kept per thread, older ones are overwritten
+
+struct ProfileNode;
+
+// Heap allocations made by this thread, counted by ProfileAlloc.cpp when it is linked in
+extern thread_local uint64_t profileAllocCount;
+extern thread_local uint64_t profileAllocBytes;
+extern bool profileAllocHooked;     // Set by ProfileAlloc.cpp, the allocation columns show "-" without it
+
+// One timed phase, from construction to the end of the scope
+class ProfileScope {
+public:
+    explicit ProfileScope(const char *name);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+    const char *name;
+    bool active = false;                // Profiling or tracing when the scope started
+    ProfileNode *node = nullptr;        // Null when not profiling
+    ProfileNode *parent = nullptr;
+    std::chrono::steady_clock::time_point wallStart;
+    uint64_t cpuStartNs = 0;
+    uint64_t allocStart = 0, allocBytesStart = 0;
+};
+
+// A span for the timeline only, too fine-grained for the phase tree
+class ProfileSpan {
+public:
+    ProfileSpan(const char *name, const char *category);
+    ~ProfileSpan();
+
+    ProfileSpan(const ProfileSpan &) = delete;
+    ProfileSpan &operator=(const ProfileSpan &) = delete;
+
+private:
+    const char *name;
+    const char *category;
+    bool active = false;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_SPAN(name, category) ProfileSpan PROFILE_CONCAT(profileSpan, __LINE__)(name, category)
+#else
+#define PROFILE_SCOPE(name) static_cast<void>(0)
+#define PROFILE_SPAN(name, category) static_cast<void>(0)
+#endif
+
+#endif //PROFILE_H
@@ -0,0 +1,34 @@
+// ProfileAlloc.cpp
+// Counting global operator new for the --profile allocation columns. Replaces the allocator of the
+// whole program, so it is only linked into vfs built with VFS_PROFILE_ALLOC, never into vfs_core
+#include "Profile.h"
+
+#ifdef VFS_PROFILE
+#include <new>
+#include <cstdlib>     // for malloc()
+
+using namespace std;
+
+static const bool hooked = (profileAllocHooked = true);
+
+void *operator new(const size_t size) {
+    ++profileAllocCount;
+    profileAllocBytes += size;
+    if (void *p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+void *operator new[](const size_t size) {
+    return operator new(size);
+}
+
+// GCC can't tell these belong to the operator new above
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+#pragma GCC diagnostic pop
+
+#endif
@@ -0,0 +1,287 @@
+// ShardedVolume.cpp
+// Sharded volumes: a manifest of independent virtual disks, file names are spread over them
+// with a consistent hash. Each shard is a normal disk opened with its own VirtualFileSystem,
+// so shards never share any state and can be worked on from separate threads
+#include "ShardedVolume.h"
+#include "Profile.h"
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <thread>
+
+using namespace std;
+
+// FNV-1a followed by the splitmix64 finalizer, FNV alone clusters similar names on the ring
+static uint64_t hashName(const string &name) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char c: name) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    return h ^ h >> 31;
+}
+
+ShardedVolume::ShardedVolume(std::string manifestPath) : manifestPath(std::move(manifestPath)) {
+}
+
+bool ShardedVolume::create(const std::vector<std::string> &shardPaths, const uint32_t shardSize) {
+    if (shardPaths.empty()) {
+        cerr << "Error: A volume needs at least one shard\n";
+        return false;
+    }
+    shards = shardPaths;
+    vector<uint32_t> all(shards.size());
+    for (uint32_t i = 0; i < all.size(); ++i) all[i] = i;
+    if (!fanOut(all, [&](const uint32_t shard) {
+        VirtualFileSystem vfs(shardPath(shard));
+        return vfs.createDisk(shardSize);
+    })) {
+        return false;
+    }
+    if (!writeManifest()) return false;
+
+    cout << "Volume '" << manifestPath << "' created with " << shards.size() << " shards.\n";
+    return true;
+}
+
+bool ShardedVolume::load() {
+    ifstream in(manifestPath);
+    if (!in) {
+        cerr << "Error: Cannot open volume manifest '" << manifestPath << "'\n";
+        return false;
+    }
+    string line;
+    if (!getline(in, line) || line != VOLUME_MAGIC) {
+        cerr << "Error: '" << manifestPath << "' is not a volume manifest\n";
+        return false;
+    }
+    shards.clear();
+    while (getline(in, line)) {
+        if (!line.empty()) shards.push_back(line);
+    }
+    if (shards.empty()) {
+        cerr << "Error: Volume '" << manifestPath << "' has no shards\n";
+        return false;
+    }
+    buildRing();
+    return true;
+}
+
+// Write to a temporary file first and rename it over the manifest, so a crash leaves either version
+bool ShardedVolume::writeManifest() const {
+    const string tmpPath = manifestPath + ".tmp";
+    {
+        ofstream out(tmpPath, ios::trunc);
+        out << VOLUME_MAGIC << "\n";
+        for (const auto &shard: shards) out << shard << "\n";
+        out.flush();
+        if (!out) {
+            cerr << "Error: Failed to write volume manifest '" << tmpPath << "'\n";
+            return false;
+        }
+    }
+    error_code ec;
+    filesystem::rename(tmpPath, manifestPath, ec);
+    if (ec) {
+        cerr << "Error: Failed to replace volume manifest '" << manifestPath << "': " << ec.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+void ShardedVolume::buildRing() {
+    ring.clear();
+    for (uint32_t shard = 0; shard < shards.size(); ++shard) {
+        for (uint32_t point = 0; point < RING_POINTS_PER_SHARD; ++point) {
+            ring.emplace_back(hashName("shard-" + to_string(shard) + "#" + to_string(point)), shard);
+        }
+    }
+    sort(ring.begin(), ring.end());
+}
+
+// The owner is the first ring point at or after the name's hash, wrapping around
+uint32_t ShardedVolume::shardFor(const std::string &fileName) const {
+    auto it = lower_bound(ring.begin(), ring.end(), make_pair(hashName(fileName), 0u));
+    if (it == ring.end()) it = ring.begin();
+    return it->second;
+}
+
+std::string ShardedVolume::shardPath(const uint32_t shard) const {
+    const filesystem::path path(shards[shard]);
+    if (path.is_absolute()) return path.string();
+    return (filesystem::path(manifestPath).parent_path() / path).string();
+}
+
+// One thread per shard, the calling thread takes the last one
+bool ShardedVolume::fanOut(const std::vector<uint32_t> &which, const std::function<bool(uint32_t)> &work) {
+    if (which.empty()) return true;
+    vector<char> ok(which.size(), 0);
+    vector<thread> workers;
+    for (size_t i = 0; i + 1 < which.size(); ++i) {
+        workers.emplace_back([&, i] { ok[i] = work(which[i]); });
+    }
+    ok.back() = work(which.back());
+    PROFILE_SPAN("wait for shards", "wait");
+    for (auto &worker: workers) worker.join();
+    return all_of(ok.begin(), ok.end(), [](const char good) { return good; });
+}
+
+// Group the files by shard and put each group through one load of its shard
+bool ShardedVolume::putFiles(const std::vector<std::string> &hostFiles) {
+    map<uint32_t, vector<string> > groups;
+    for (const auto &hostFile: hostFiles) {
+        groups[shardFor(filesystem::path(hostFile).filename().string())].push_back(hostFile);
+    }
+    vector<uint32_t> which;
+    for (const auto &group: groups) which.push_back(group.first);
+
+    return fanOut(which, [&](const uint32_t shard) {
+        VirtualFileSystem vfs(shardPath(shard));
+        if (!vfs.loadDisk()) return false;
+        bool ok = true;
+        for (const auto &hostFile: groups.at(shard)) {
+            ok = vfs.copyFromHost(hostFile) && ok;
+        }
+        return ok;
+    });
+}
+
+bool ShardedVolume::getFile(const std::string &fileName, const std::string &destPath) {
+    VirtualFileSystem vfs(shardPath(shardFor(fileName)));
+    if (!vfs.loadDisk(true)) return false;
+    return vfs.copyToHost(fileName, destPath);
+}
+
+bool ShardedVolume::deleteFile(const std::string &fileName) {
+    VirtualFileSystem vfs(shardPath(shardFor(fileName)));
+    if (!vfs.loadDisk()) return false;
+    return vfs.deleteFile(fileName);
+}
+
+// Load all shards in parallel, then print them in manifest order
+bool ShardedVolume::listFiles() {
+    vector<unique_ptr<VirtualFileSystem> > disks(shards.size());
+    vector<uint32_t> all(shards.size());
+    for (uint32_t i = 0; i < all.size(); ++i) all[i] = i;
+    const bool ok = fanOut(all, [&](const uint32_t shard) {
+        disks[shard] = make_unique<VirtualFileSystem>(shardPath(shard));
+        return disks[shard]->loadDisk(true);
+    });
+
+    for (uint32_t shard = 0; shard < shards.size(); ++shard) {
+        cout << "Shard " << shard << " '" << shards[shard] << "':\n";
+        if (disks[shard]) disks[shard]->listFiles();
+        cout << "\n";
+    }
+    return ok;
+}
+
+bool ShardedVolume::addShard(const std::string &path, const uint32_t shardSize) {
+    if (find(shards.begin(), shards.end(), path) != shards.end()) {
+        cerr << "Error: '" << path << "' is already a shard of this volume\n";
+        return false;
+    }
+    shards.push_back(path);
+    if (VirtualFileSystem vfs(shardPath(static_cast<uint32_t>(shards.size() - 1))); !vfs.createDisk(shardSize)) {
+        return false;
+    }
+    if (!writeManifest()) return false;
+    buildRing();
+    return rebalance();
+}
+
+// Three passes: find the misplaced files (all shards in parallel), copy them onto their owners
+// (one thread per owner), then delete them from where they were (one thread per source)
+// Copies go before deletes, so a crash leaves a file on two shards rather than on none, and
+// running rebalance again finishes the job
+bool ShardedVolume::rebalance() {
+    vector<uint32_t> all(shards.size());
+    for (uint32_t i = 0; i < all.size(); ++i) all[i] = i;
+
+    struct Move {
+        string name;
+        uint32_t from;
+    };
+    vector<vector<string> > names(shards.size());
+    if (!fanOut(all, [&](const uint32_t shard) {
+        VirtualFileSystem vfs(shardPath(shard));
+        if (!vfs.loadDisk(true)) return false;
+        names[shard] = vfs.fileNames();
+        return true;
+    })) {
+        return false;
+    }
+    map<uint32_t, vector<Move> > incoming;
+    for (uint32_t shard = 0; shard < shards.size(); ++shard) {
+        for (const auto &name: names[shard]) {
+            if (const uint32_t owner = shardFor(name); owner != shard) incoming[owner].push_back({name, shard});
+        }
+    }
+    if (incoming.empty()) {
+        cout << "Volume '" << manifestPath << "' is balanced, nothing to move.\n";
+        return true;
+    }
+
+    // Files go disk to disk, each owner loads the sources it takes from once
+    // An owner can be another owner's source, so every thread locks its disks in shard order
+    vector<uint32_t> owners;
+    for (const auto &entry: incoming) owners.push_back(entry.first);
+    vector<vector<char> > copied(shards.size());
+    const bool copiedAll = fanOut(owners, [&](const uint32_t owner) {
+        const vector<Move> &moves = incoming.at(owner);
+        copied[owner].assign(moves.size(), 0);
+        map<uint32_t, unique_ptr<VirtualFileSystem> > disks;  // Ordered by shard index
+        disks[owner] = nullptr;
+        for (const auto &move: moves) disks[move.from] = nullptr;
+        for (auto &[shard, disk]: disks) {
+            disk = make_unique<VirtualFileSystem>(shardPath(shard));
+            if (!disk->loadDisk(shard != owner)) {
+                if (shard == owner) return false;
+                disk.reset();
+            }
+        }
+        VirtualFileSystem &target = *disks[owner];
+        const vector<string> present = target.fileNames();
+        for (size_t i = 0; i < moves.size(); ++i) {
+            // Left behind by an interrupted rebalance, only the delete is missing
+            if (find(present.begin(), present.end(), moves[i].name) != present.end()) {
+                copied[owner][i] = 1;
+                continue;
+            }
+            if (const auto &source = disks[moves[i].from]) {
+                copied[owner][i] = source->copyToDisk(moves[i].name, target, "");
+            }
+        }
+        return all_of(copied[owner].begin(), copied[owner].end(), [](const char good) { return good; });
+    });
+
+    map<uint32_t, vector<string> > outgoing;
+    size_t moved = 0;
+    for (const auto &[owner, moves]: incoming) {
+        for (size_t i = 0; i < moves.size(); ++i) {
+            if (copied[owner][i]) outgoing[moves[i].from].push_back(moves[i].name);
+        }
+    }
+    vector<uint32_t> sources;
+    for (const auto &entry: outgoing) {
+        sources.push_back(entry.first);
+        moved += entry.second.size();
+    }
+    const bool deletedAll = fanOut(sources, [&](const uint32_t shard) {
+        VirtualFileSystem vfs(shardPath(shard));
+        if (!vfs.loadDisk()) return false;
+        bool ok = true;
+        for (const auto &name: outgoing.at(shard)) {
+            ok = vfs.deleteFile(name) && ok;
+        }
+        return ok;
+    });
+
+    cout << "Rebalanced volume '" << manifestPath << "': " << moved << " files moved.\n";
+    return copiedAll && deletedAll;
+}
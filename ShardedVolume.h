@@ -0,0 +1,56 @@
+//
+// Sharded volume: one namespace spread over several independent virtual disks
+//
+
+#ifndef SHARDEDVOLUME_H
+#define SHARDEDVOLUME_H
+#include    <string>
+#include    <cstdint>
+#include    <vector>
+#include    <functional>
+#include    "VirtualFileSystem.h"
+
+static constexpr char VOLUME_MAGIC[] = "TTvol01";          // First line of a volume manifest
+static constexpr uint32_t RING_POINTS_PER_SHARD = 64;       // Points of every shard on the hash ring
+
+// A volume is a manifest file listing its shard disks, one per line after the magic
+// Every file name belongs to exactly one shard, picked by consistent hashing, so adding
+// a shard only moves about 1/N of the files. Shards are identified by their position in
+// the manifest (not their path), so shard disks can be moved to other mounts freely
+class ShardedVolume {
+public:
+    explicit ShardedVolume(std::string manifestPath);
+
+    // Create the shard disks (plain, shardSize bytes each) and the manifest
+    bool create(const std::vector<std::string> &shardPaths, uint32_t shardSize);
+
+    // Read the manifest
+    bool load();
+
+    // File operations, bulk ones run on all involved shards in parallel
+    bool putFiles(const std::vector<std::string> &hostFiles);                   // HOST -> volume
+    bool getFile(const std::string &fileName, const std::string &destPath);     // volume -> HOST
+    bool deleteFile(const std::string &fileName);                               // Remove file from volume
+    bool listFiles();                                                           // "ls" of every shard
+
+    // Create a new shard disk, append it to the manifest and move the files it now owns onto it
+    bool addShard(const std::string &path, uint32_t shardSize);
+
+    // Move every file that is not on the shard owning its name
+    bool rebalance();
+
+private:
+    std::string manifestPath;                           // Path to the manifest file
+    std::vector<std::string> shards;                    // Shard disks as written in the manifest
+    std::vector<std::pair<uint64_t, uint32_t> > ring;   // Hash ring: (point, shard), sorted by point
+
+    bool writeManifest() const;
+    void buildRing();
+    uint32_t shardFor(const std::string &fileName) const;
+    std::string shardPath(uint32_t shard) const;        // Relative paths are relative to the manifest
+
+    // Run work(shard) for every shard in 'which' on its own thread, true if all of them succeeded
+    static bool fanOut(const std::vector<uint32_t> &which, const std::function<bool(uint32_t)> &work);
+};
+
+#endif //SHARDEDVOLUME_H
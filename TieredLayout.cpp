@@ -0,0 +1,145 @@
+// TieredLayout.cpp
+// Tiered disks: every data block has a home in the slow tier file, the hottest ones are kept
+// in a small fast tier file instead. Reads count towards a block's heat, and a budgeted
+// migration pass (dtier) moves blocks between the tiers
+#include "VirtualFileSystem.h"
+#include "Profile.h"
+#include "IoStats.h"
+#include <iostream>
+#include <algorithm>
+#include <fcntl.h>     // for open()
+#include <unistd.h>    // for fsync()
+
+using namespace std;
+
+static constexpr int32_t FAT_FREE = 0;      // Same marker as in VirtualFileSystem.cpp
+static constexpr uint32_t FAST_TIER = 0;    // Member index of the fast tier file
+static constexpr uint32_t SLOW_TIER = 1;    // Member index of the slow tier file
+
+// Read the tier table of a tiered disk
+bool VirtualFileSystem::readTierTable() {
+    PROFILE_SCOPE("readTierTable");
+    tiers.assign(sb.totalBlocks, TierEntry{});
+    disk.seekg(static_cast<uint64_t>(sb.tierStartBlock) * BLOCK_SIZE);
+    disk.read(reinterpret_cast<char *>(tiers.data()), sb.totalBlocks * sizeof(TierEntry));
+    ioAccount(diskIo, IO_TABLES, false, static_cast<uint64_t>(sb.tierStartBlock) * BLOCK_SIZE,
+              sb.totalBlocks * sizeof(TierEntry));
+    return disk.good();
+}
+
+// Write the tier table of a tiered disk
+bool VirtualFileSystem::writeTierTable() {
+    PROFILE_SCOPE("writeTierTable");
+    disk.seekp(static_cast<uint64_t>(sb.tierStartBlock) * BLOCK_SIZE);
+    disk.write(reinterpret_cast<char *>(tiers.data()), sb.totalBlocks * sizeof(TierEntry));
+    ioAccount(diskIo, IO_TABLES, true, static_cast<uint64_t>(sb.tierStartBlock) * BLOCK_SIZE,
+              sb.totalBlocks * sizeof(TierEntry));
+    return disk.good();
+}
+
+// Move a batch to or from wherever each block currently lives, both tiers in parallel
+bool VirtualFileSystem::transferTiered(const vector<int32_t> &blocks, char *buffer, const bool write) {
+    vector<vector<pair<uint64_t, size_t> > > runs(sb.memberCount);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        TierEntry &entry = tiers[blocks[i]];
+        if (entry.fastSlot > 0) runs[FAST_TIER].emplace_back(entry.fastSlot - 1, i);
+        else runs[SLOW_TIER].emplace_back(blocks[i] - sb.dataStartBlock, i);
+        if (!write && entry.heat < UINT32_MAX) ++entry.heat;
+    }
+    const vector<char> ok = transferMembers(runs, buffer, write);
+    return ok[FAST_TIER] && ok[SLOW_TIER];
+}
+
+// Promote the hottest slow blocks into free fast slots, or in place of fast blocks that are colder,
+// until budgetBlocks blocks have been copied. Free blocks in the fast tier give up their slot for nothing
+// Every pass halves all heat, so old accesses count less and less
+bool VirtualFileSystem::migrateTiers(const uint32_t budgetBlocks) {
+    PROFILE_SCOPE("migrateTiers");
+    if (sb.imageType != IMAGE_TIERED) {
+        cerr << "Error: '" << diskPath << "' is not a tiered disk\n";
+        return false;
+    }
+
+    vector<uint32_t> hot, resident;
+    vector<char> slotUsed(sb.fastBlocks, 0);
+    for (uint32_t i = sb.dataStartBlock; i < sb.totalBlocks; ++i) {
+        if (tiers[i].fastSlot > 0) {
+            resident.push_back(i);
+            slotUsed[tiers[i].fastSlot - 1] = 1;
+        } else if (FAT[i] != FAT_FREE && tiers[i].heat > 0) {
+            hot.push_back(i);
+        }
+    }
+    // Free blocks rank below everything that is in use
+    auto rank = [&](const uint32_t blk) -> int64_t { return FAT[blk] == FAT_FREE ? -1 : tiers[blk].heat; };
+    sort(hot.begin(), hot.end(), [&](const uint32_t a, const uint32_t b) { return tiers[a].heat > tiers[b].heat; });
+    sort(resident.begin(), resident.end(), [&](const uint32_t a, const uint32_t b) { return rank(a) < rank(b); });
+
+    uint32_t budget = budgetBlocks, promoted = 0, demoted = 0;
+    size_t coldest = 0, freeSlot = 0;
+    vector<char> buffer(BLOCK_SIZE);
+    auto copyBlock = [&](const uint32_t fromMember, const uint64_t from, const uint32_t toMember, const uint64_t to) {
+        vector<pair<uint64_t, size_t> > source{{from, 0}}, target{{to, 0}};
+        return transferRun(memberFiles[fromMember], memberIo[fromMember], source, buffer.data(), false) &&
+               transferRun(memberFiles[toMember], memberIo[toMember], target, buffer.data(), true);
+    };
+
+    // Demotions first: a victim's slot may only be reused once the table on disk no longer points at it,
+    // or a crash in between would leave the victim mapped to another block's data
+    vector<pair<uint32_t, uint32_t> > promotions;   // Block, fast slot
+    for (const uint32_t blk: hot) {
+        if (budget == 0) break;
+        while (freeSlot < slotUsed.size() && slotUsed[freeSlot]) ++freeSlot;
+        uint32_t slot;
+        if (freeSlot < slotUsed.size()) {
+            slot = static_cast<uint32_t>(freeSlot);
+        } else {
+            // Fast tier is full, swap out its coldest block if it's colder than this one
+            if (coldest >= resident.size() || rank(resident[coldest]) >= tiers[blk].heat) break;
+            const uint32_t victim = resident[coldest++];
+            slot = tiers[victim].fastSlot - 1;
+            if (FAT[victim] != FAT_FREE) {
+                if (budget < 2) break;
+                if (!copyBlock(FAST_TIER, slot, SLOW_TIER, victim - sb.dataStartBlock)) return false;
+                --budget;
+                ++demoted;
+            }
+            tiers[victim].fastSlot = 0;
+        }
+        promotions.emplace_back(blk, slot);
+        slotUsed[slot] = 1;
+        --budget;
+    }
+    auto syncMember = [&](const uint32_t m) {
+        memberFiles[m].flush();
+        const int fd = open(resolveBackingPath(sb.members[m], MEMBER_PATH_LEN).c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        const bool ok = fsync(fd) == 0;
+        close(fd);
+        return ok && memberFiles[m].good();
+    };
+    if (demoted > 0 && (!syncMember(SLOW_TIER) || !writeTierTable() || !syncDisk())) {
+        cerr << "Error: Failed to write the tier table\n";
+        return false;
+    }
+
+    // Then the promotions, the slow copy stays where it is until the table points at the fast one
+    for (const auto &[blk, slot]: promotions) {
+        if (!copyBlock(SLOW_TIER, blk - sb.dataStartBlock, FAST_TIER, slot)) return false;
+        tiers[blk].fastSlot = slot + 1;
+        ++promoted;
+    }
+
+    for (uint32_t i = sb.dataStartBlock; i < sb.totalBlocks; ++i) {
+        tiers[i].heat /= 2;
+    }
+    if (!syncMember(FAST_TIER) || !writeTierTable() || !syncDisk()) {
+        cerr << "Error: Failed to write the tier table\n";
+        return false;
+    }
+
+    const auto used = static_cast<uint32_t>(count(slotUsed.begin(), slotUsed.end(), 1));
+    cout << "Tier migration on '" << diskPath << "': " << promoted << " blocks promoted, " << demoted
+            << " demoted, fast tier " << used << "/" << sb.fastBlocks << " blocks in use.\n";
+    return true;
+}
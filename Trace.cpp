@@ -0,0 +1,185 @@
+// Trace.cpp
+// Writing, reading and replaying operation traces
+#include "Trace.h"
+#include "VirtualFileSystem.h"
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <cstring>
+#include <fcntl.h>     // for open()
+#include <unistd.h>    // for write(), getpid()
+#include <sys/stat.h>  // for fstat()
+#include <sys/file.h>  // for flock()
+
+using namespace std;
+
+uint64_t traceHash(const std::string &name) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char c: name) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Under a lock, or two processes starting on an empty file would both write the magic
+// A record torn by a crash is cut off before appending, so the records after it stay aligned
+bool appendTrace(const std::string &path, const TraceRecord &record) {
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return false;
+    if (flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        return false;
+    }
+    char buffer[sizeof(TRACE_MAGIC) + sizeof(TraceRecord)];
+    size_t length = 0;
+    struct stat info{};
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+    auto size = static_cast<uint64_t>(info.st_size);
+    if (size < sizeof(TRACE_MAGIC)) {
+        size = 0;
+    } else {
+        size -= (size - sizeof(TRACE_MAGIC)) % sizeof(TraceRecord);
+    }
+    if (size != static_cast<uint64_t>(info.st_size) && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        return false;
+    }
+    if (size == 0) {
+        memcpy(buffer, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        length = sizeof(TRACE_MAGIC);
+    }
+    memcpy(buffer + length, &record, sizeof(record));
+    length += sizeof(record);
+    const bool ok = write(fd, buffer, length) == static_cast<ssize_t>(length);
+    close(fd);  // Releases the lock
+    return ok;
+}
+
+bool readTrace(const std::string &path, std::vector<TraceRecord> &records) {
+    ifstream in(path, ios::binary);
+    char magic[sizeof(TRACE_MAGIC)];
+    if (!in || !in.read(magic, sizeof(magic)) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        cerr << "Error: '" << path << "' is not a trace file\n";
+        return false;
+    }
+    records.clear();
+    TraceRecord record{};
+    // A record cut short by a crash at the end is dropped
+    while (in.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+        records.push_back(record);
+    }
+    return true;
+}
+
+bool replayTrace(const std::string &tracePath, const std::string &diskPath, const bool fast, const uint32_t diskSize) {
+    vector<TraceRecord> records;
+    if (!readTrace(tracePath, records)) return false;
+    if (records.empty()) {
+        cout << "Trace '" << tracePath << "' is empty, nothing to replay.\n";
+        return true;
+    }
+
+    VirtualFileSystem vfs(diskPath);
+    if (!filesystem::exists(diskPath) && !vfs.createDisk(diskSize)) return false;
+    if (!vfs.loadDisk()) return false;
+
+    // Files already on the disk keep their names, any other hash gets a made-up one
+    map<uint64_t, string> names;
+    for (const auto &name: vfs.fileNames()) names[traceHash(name)] = name;
+    auto nameFor = [&](const uint64_t hash) -> const string & {
+        auto it = names.find(hash);
+        if (it == names.end()) {
+            char name[20];
+            snprintf(name, sizeof(name), "h%016llx", static_cast<unsigned long long>(hash));
+            it = names.emplace(hash, name).first;
+        }
+        return it->second;
+    };
+
+    // Synthetic contents for created files go through a scratch directory, dput takes host files
+    const filesystem::path scratch = filesystem::temp_directory_path() / ("ttvfs-replay-" + to_string(getpid()));
+    filesystem::create_directories(scratch);
+
+    struct OpStats {
+        uint64_t count = 0, failed = 0;
+        double totalNs = 0, maxNs = 0;
+    };
+    const char *opNames[] = {"?", "create", "read", "delete", "rename", "stat"};
+    map<uint8_t, OpStats> stats;
+    double maxLagNs = 0;
+    const auto start = chrono::steady_clock::now();
+    for (const auto &record: records) {
+        if (!fast) {
+            // Original timing, relative to the first operation
+            const auto due = start + chrono::nanoseconds(record.timestamp - records.front().timestamp);
+            this_thread::sleep_until(due);
+            maxLagNs = max(maxLagNs, chrono::duration<double, nano>(chrono::steady_clock::now() - due).count());
+        }
+        const string name = nameFor(record.nameHash);
+        string hostFile;
+        if (record.op == TRACE_CREATE) {
+            hostFile = (scratch / name).string();
+            ofstream out(hostFile, ios::binary | ios::trunc);
+            mt19937_64 rng(record.nameHash);
+            vector<uint64_t> chunk(IO_BATCH_BLOCKS * BLOCK_SIZE / sizeof(uint64_t));
+            for (uint64_t left = record.length; left > 0;) {
+                for (auto &word: chunk) word = rng();
+                const auto n = static_cast<streamsize>(min<uint64_t>(left, chunk.size() * sizeof(uint64_t)));
+                out.write(reinterpret_cast<const char *>(chunk.data()), n);
+                left -= n;
+            }
+        }
+
+        bool ok = false;
+        DirEntry info{};
+        const auto opStart = chrono::steady_clock::now();
+        {
+            Silence quietOut(cout), quietErr(cerr);
+            switch (record.op) {
+                case TRACE_CREATE: ok = vfs.copyFromHost(hostFile);
+                    break;
+                case TRACE_READ: ok = vfs.copyToHost(name, "/dev/null");
+                    break;
+                case TRACE_DELETE: ok = vfs.deleteFile(name);
+                    break;
+                case TRACE_RENAME: ok = vfs.renameFile(name, nameFor(record.offset));
+                    break;
+                case TRACE_STAT: ok = vfs.statFile(name, info);
+                    break;
+                default: break;
+            }
+        }
+        const double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - opStart).count();
+        if (!hostFile.empty()) filesystem::remove(hostFile);
+
+        OpStats &op = stats[record.op <= TRACE_STAT ? record.op : 0];
+        ++op.count;
+        op.failed += !ok;
+        op.totalNs += ns;
+        op.maxNs = max(op.maxNs, ns);
+    }
+    const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    filesystem::remove_all(scratch);
+
+    cout << "Replayed " << records.size() << " operations from '" << tracePath << "' on '" << diskPath << "' in "
+            << fixed << setprecision(3) << elapsed << " s" << (fast ? " (full speed)" : "") << ".\n";
+    cout << left << setw(8) << "Op" << right << setw(10) << "Count" << setw(10) << "Failed"
+            << setw(14) << "Mean (us)" << setw(14) << "Max (us)" << "\n";
+    cout << string(56, '-') << "\n";
+    for (const auto &[op, s]: stats) {
+        cout << left << setw(8) << opNames[op] << right << setw(10) << s.count << setw(10) << s.failed
+                << setw(14) << setprecision(1) << s.totalNs / s.count / 1000 << setw(14) << s.maxNs / 1000 << "\n";
+    }
+    if (!fast) {
+        cout << "Largest delay behind the original timing: " << setprecision(3) << maxLagNs / 1e6 << " ms\n";
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+//
+// Operation traces: what was done to a disk and when, without names or data
+// Recorded with --trace=<file>, played back by "vfs replay"
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+#include    <string>
+#include    <cstdint>
+#include    <vector>
+#include    <ostream>
+
+static constexpr char TRACE_MAGIC[8] = "TTtrc01";   // First 8 bytes of a trace file
+
+// Traced operations
+static constexpr uint8_t TRACE_CREATE = 1;  // dput, length = file size
+static constexpr uint8_t TRACE_READ = 2;    // dget, offset and length of the part read
+static constexpr uint8_t TRACE_DELETE = 3;  // ddel
+static constexpr uint8_t TRACE_RENAME = 4;  // drename, offset = hash of the new name
+static constexpr uint8_t TRACE_STAT = 5;    // dstat
+
+// One operation, 33 bytes on disk
+#pragma pack(push, 1)
+struct TraceRecord {
+    uint64_t timestamp;     // Wall clock, ns since the epoch, so invocations of the CLI line up
+    uint8_t op;             // One of TRACE_*
+    uint64_t nameHash;      // traceHash() of the file name
+    uint64_t offset;        // Byte offset (see the ops above)
+    uint64_t length;        // Byte count
+};
+#pragma pack(pop)
+
+// FNV-1a of a file name, names themselves never go into a trace
+uint64_t traceHash(const std::string &name);
+
+// Append a record to a trace file, writing the magic first if the file is new
+// Every record is written with one append under a lock, so several processes can trace into the same file
+bool appendTrace(const std::string &path, const TraceRecord &record);
+
+// Read a whole trace file
+bool readTrace(const std::string &path, std::vector<TraceRecord> &records);
+
+// Play a trace against diskPath, creating a diskSize disk first if it doesn't exist
+// Names come from the disk's own files where the hashes match, otherwise they are made up from
+// the hash, and file contents are synthetic. With fast set there are no pauses between operations
+bool replayTrace(const std::string &tracePath, const std::string &diskPath, bool fast, uint32_t diskSize);
+
+// Swallows everything written to a stream while it lives, keeps the per-operation messages of
+// the disk out of the replay and dbench reports
+class Silence {
+public:
+    explicit Silence(std::ostream &stream) : stream(stream), saved(stream.rdbuf(&sink)) {
+    }
+
+    ~Silence() { stream.rdbuf(saved); }
+
+    Silence(const Silence &) = delete;
+    Silence &operator=(const Silence &) = delete;
+
+private:
+    struct NullBuffer : std::streambuf {
+        int overflow(const int c) override { return c; }
+        std::streamsize xsputn(const char *, const std::streamsize n) override { return n; }
+    } sink;
+
+    std::ostream &stream;
+    std::streambuf *saved;
+};
+
+#endif //TRACE_H
@@ -1,13 +1,27 @@
 // VirtualFileSystem.cpp
 #include "VirtualFileSystem.h"
+#include "Profile.h"
+#include "Format.h"
+#include "Trace.h"
+#include "IoStats.h"
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <cstddef>     // for offsetof
 #include <ctime>
 #include <iomanip>
 #include <cstdio>      // for remove()
 #include <algorithm>
+#include <bit>         // for countl_zero()
 #include <utility> // for std::move
+#include <filesystem>
+#include <map>
+#include <chrono>
+#include <tuple>
+#include <cerrno>
+#include <fcntl.h>     // for open()
+#include <sys/file.h>  // for flock()
+#include <unistd.h>    // for fsync()
 
 using namespace std;
 
@@ -22,15 +36,49 @@ VirtualFileSystem::VirtualFileSystem(std::string diskPath)
     // Reserve directory entries.
 }
 
-// Destructor: close disk file if open
+void VirtualFileSystem::traceTo(const std::string &path) {
+    tracePath = path;
+}
+
+// Append one operation to the trace, if tracing
+void VirtualFileSystem::traceOp(const uint8_t op, const std::string &name, const uint64_t offset,
+                                const uint64_t length) const {
+    if (tracePath.empty()) return;
+    const TraceRecord record{
+        static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+            chrono::system_clock::now().time_since_epoch()).count()),
+        op, traceHash(name), offset, length
+    };
+    if (!appendTrace(tracePath, record)) {
+        cerr << "Warning: Failed to write to trace file '" << tracePath << "'\n";
+    }
+}
+
+// Destructor: close disk file if open, and add what was measured to the disk's .stats and .heat files
+// Read-only loads (dls and friends, overlay bases) leave .stats alone: a base shared by many overlays
+// would otherwise be written, and its lock taken, by every command on any of them
 VirtualFileSystem::~VirtualFileSystem() {
     if (disk.is_open()) {
         disk.close(); // Just close the fstream, nothing fancy
     }
+    if (lockFd >= 0) close(lockFd);  // Releases the disk lock
+    if (const MetricsSnapshot snapshot = stats.snapshot(); keepStats && !readOnly && !snapshot.empty()) {
+        if (!addToStatsFile(diskPath + STATS_SUFFIX, snapshot)) {
+            cerr << "Warning: Failed to update '" << diskPath << STATS_SUFFIX << "'\n";
+        }
+    }
+    if (keepStats && !heat.empty() && !addToHeatFile(diskPath + HEAT_SUFFIX, heat.snapshot())) {
+        cerr << "Warning: Failed to update '" << diskPath << HEAT_SUFFIX << "'\n";
+    }
+}
+
+MetricsSnapshot VirtualFileSystem::metrics() const {
+    return stats.snapshot();
 }
 
 // Create a new VD file and initialize filesystem structures
-bool VirtualFileSystem::createDisk(uint32_t diskSize) {
+bool VirtualFileSystem::createDisk(uint32_t diskSize, const DiskLayout &layout) {
+    PROFILE_SCOPE("createDisk");
     // Adjust disk size to a multiple of BLOCK_SIZE
     // So, if the user specified 1000 bytes, it will be rounded up to 1024
     if (diskSize == 0) {
@@ -40,6 +88,92 @@ bool VirtualFileSystem::createDisk(uint32_t diskSize) {
         diskSize = ((diskSize / BLOCK_SIZE) + 1) * BLOCK_SIZE;
     }
 
+    // Initialize superblock
+    memset(&sb, 0, sizeof(sb)); // Clear the superblock structure
+    memcpy(sb.fsName, FS_NAME, sizeof(sb.fsName));
+    sb.blockSize = BLOCK_SIZE;
+    sb.totalBlocks = diskSize / BLOCK_SIZE;
+    sb.totalDirEntries = MAX_FILES;
+    sb.dirStartBlock = 1;
+    // Calculate blocks for directory
+    constexpr uint32_t dirBytes = MAX_FILES * sizeof(DirEntry);
+    sb.dirBlockCount = (dirBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    sb.fatStartBlock = sb.dirStartBlock + sb.dirBlockCount;
+    // Calculate blocks for FAT (one int32 per block)
+    const uint32_t fatBytes = sb.totalBlocks * sizeof(int32_t);
+    sb.fatBlockCount = (fatBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    sb.dataStartBlock = sb.fatStartBlock + sb.fatBlockCount;
+    if (sb.dataStartBlock >= sb.totalBlocks) {
+        cerr << "Error: Disk is too small to hold any data\n";
+        return false;
+    }
+
+    // Multi-file images keep only the metadata in this file
+    sb.imageType = layout.imageType;
+    if (layout.imageType == IMAGE_STRIPED || layout.imageType == IMAGE_MIRRORED || layout.imageType == IMAGE_PARITY ||
+        layout.imageType == IMAGE_SPLIT || layout.imageType == IMAGE_TIERED) {
+        if (layout.imageType == IMAGE_SPLIT && layout.members.size() != 1) {
+            cerr << "Error: A split disk needs exactly one data file\n";
+            return false;
+        }
+        if (layout.imageType == IMAGE_TIERED && (layout.members.size() != 2 || layout.fastBlocks == 0)) {
+            cerr << "Error: A tiered disk needs a fast and a slow file, and a fast tier of at least one block\n";
+            return false;
+        }
+        if (layout.imageType != IMAGE_SPLIT && (layout.members.size() < 2 || layout.members.size() > MAX_MEMBERS)) {
+            cerr << "Error: A multi-file disk needs between 2 and " << MAX_MEMBERS << " member files\n";
+            return false;
+        }
+        if (layout.imageType == IMAGE_PARITY) {
+            if (layout.parityCount < 1 || layout.parityCount > 2 || layout.members.size() < layout.parityCount + 2) {
+                cerr << "Error: A parity disk has 1 or 2 parity members and at least 2 data members\n";
+                return false;
+            }
+            sb.parityCount = layout.parityCount;
+        }
+        if (layout.stripeBlocks == 0) {
+            cerr << "Error: Stripe unit must be at least one block\n";
+            return false;
+        }
+        sb.stripeBlocks = layout.stripeBlocks;
+        sb.memberCount = static_cast<uint32_t>(layout.members.size());
+        for (uint32_t m = 0; m < sb.memberCount; ++m) {
+            if (layout.members[m].size() >= MEMBER_PATH_LEN) {
+                cerr << "Error: Member path '" << layout.members[m] << "' is too long (max "
+                        << MEMBER_PATH_LEN - 1 << " characters)\n";
+                return false;
+            }
+            strncpy(sb.members[m], layout.members[m].c_str(), MEMBER_PATH_LEN - 1);
+        }
+        // Mirrors keep a CRC32 per block after the FAT, to tell which copy of a block is good
+        if (layout.imageType == IMAGE_MIRRORED) {
+            sb.sumStartBlock = sb.dataStartBlock;
+            sb.sumBlockCount = sb.fatBlockCount;
+            sb.dataStartBlock += sb.sumBlockCount;
+            if (sb.dataStartBlock >= sb.totalBlocks) {
+                cerr << "Error: Disk is too small to hold any data\n";
+                return false;
+            }
+            checksums.assign(sb.totalBlocks, 0);
+        }
+        // Tiered disks keep a TierEntry per block after the FAT, everything starts in the slow tier
+        if (layout.imageType == IMAGE_TIERED) {
+            sb.fastBlocks = layout.fastBlocks;
+            sb.tierStartBlock = sb.dataStartBlock;
+            sb.tierBlockCount = (sb.totalBlocks * sizeof(TierEntry) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            sb.dataStartBlock += sb.tierBlockCount;
+            if (sb.dataStartBlock >= sb.totalBlocks) {
+                cerr << "Error: Disk is too small to hold any data\n";
+                return false;
+            }
+            tiers.assign(sb.totalBlocks, TierEntry{});
+        }
+    } else if (layout.imageType != IMAGE_PLAIN) {
+        cerr << "Error: Unsupported disk layout\n";
+        return false;
+    }
+    const uint32_t fileBlocks = sb.memberCount > 0 ? sb.dataStartBlock : sb.totalBlocks;
+
     // Create and size the file
     ofstream out(diskPath, ios::binary | ios::trunc);
     if (!out) {
@@ -47,10 +181,12 @@ bool VirtualFileSystem::createDisk(uint32_t diskSize) {
         return false;
     }
     // Seek to last byte and write a zero to allocate space
-    out.seekp(diskSize - 1);
+    out.seekp(static_cast<uint64_t>(fileBlocks) * BLOCK_SIZE - 1);
     constexpr char zero = '\0';
     out.write(&zero, 1);
     out.close();
+    std::remove((diskPath + STATS_SUFFIX).c_str()); // Counters of a disk that was here before
+    std::remove((diskPath + HEAT_SUFFIX).c_str());
 
     // Open the file for read/write access
     disk.open(diskPath, ios::binary | ios::in | ios::out);
@@ -58,22 +194,10 @@ bool VirtualFileSystem::createDisk(uint32_t diskSize) {
         cerr << "Error: Cannot open disk file after creation\n";
         return false;
     }
-
-    // Initialize superblock
-    memset(&sb, 0, sizeof(sb)); // Clear the superblock structure
-    memcpy(sb.fsName, FS_NAME, sizeof(sb.fsName));
-    sb.blockSize = BLOCK_SIZE;
-    sb.totalBlocks = diskSize / BLOCK_SIZE;
-    sb.totalDirEntries = MAX_FILES;
-    sb.dirStartBlock = 1;
-    // Calculate blocks for directory
-    constexpr uint32_t dirBytes = MAX_FILES * sizeof(DirEntry);
-    sb.dirBlockCount = (dirBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    sb.fatStartBlock = sb.dirStartBlock + sb.dirBlockCount;
-    // Calculate blocks for FAT (one int32 per block)
-    const uint32_t fatBytes = sb.totalBlocks * sizeof(int32_t);
-    sb.fatBlockCount = (fatBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    sb.dataStartBlock = sb.fatStartBlock + sb.fatBlockCount;
+    if (sb.memberCount > 0 && !createMembers()) {
+        disk.close();
+        return false;
+    }
 
     // Write superblock to disk (block 0)
     writeSuperblock();
@@ -93,17 +217,91 @@ bool VirtualFileSystem::createDisk(uint32_t diskSize) {
 
     disk.close();
     cout << "Virtual disk '" << diskPath << "' created ("
-            << diskSize << " bytes, " << sb.totalBlocks << " blocks).\n";
+            << diskSize << " bytes, " << sb.totalBlocks << " blocks";
+    if (sb.imageType == IMAGE_STRIPED) {
+        cout << ", striped over " << sb.memberCount << " files in units of " << sb.stripeBlocks << " blocks";
+    } else if (sb.imageType == IMAGE_MIRRORED) {
+        cout << ", mirrored on " << sb.memberCount << " files";
+    } else if (sb.imageType == IMAGE_PARITY) {
+        cout << ", " << sb.memberCount - sb.parityCount << "+" << sb.parityCount << " parity over "
+                << sb.memberCount << " files in units of " << sb.stripeBlocks << " blocks";
+    } else if (sb.imageType == IMAGE_SPLIT) {
+        cout << ", data in '" << sb.members[0] << "'";
+    } else if (sb.imageType == IMAGE_TIERED) {
+        cout << ", " << sb.fastBlocks << " blocks in fast tier '" << sb.members[0] << "', the rest in '"
+                << sb.members[1] << "'";
+    }
+    cout << ").\n";
     return true;
 }
 
-// Load an existing virtual disk (read superblock, directory, FAT into memory)
-bool VirtualFileSystem::loadDisk() {
+// Create an overlay image referencing an existing base image
+bool VirtualFileSystem::createOverlay(const std::string &basePath) {
+    PROFILE_SCOPE("createOverlay");
+    if (basePath.size() >= BASE_PATH_LEN) {
+        cerr << "Error: Base image path is too long (max " << BASE_PATH_LEN - 1 << " characters)\n";
+        return false;
+    }
+    // The base path is stored relative to the overlay, so set it first and open through it
+    memset(&sb, 0, sizeof(sb));
+    strncpy(sb.basePath, basePath.c_str(), sizeof(sb.basePath) - 1);
+    if (!openBase(true)) return false;
+
+    // Same geometry as the base, plus a block map past the last block
+    // The base's own layout (members etc.) is only of concern to the base
+    memcpy(&sb, &base->sb, offsetof(SuperBlock, imageType));
+    memset(reinterpret_cast<char *>(&sb) + offsetof(SuperBlock, imageType), 0,
+           sizeof(sb) - offsetof(SuperBlock, imageType));
+    strncpy(sb.basePath, basePath.c_str(), sizeof(sb.basePath) - 1);
+    sb.imageType = IMAGE_OVERLAY;
+    sb.mapStartBlock = sb.totalBlocks;
+    sb.mapBlockCount = ((sb.totalBlocks + 7) / 8 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    directory = base->directory;
+    FAT = base->FAT;
+    blockMap.assign(sb.mapBlockCount * BLOCK_SIZE, 0);
+
+    // Only metadata is written, so the file stays sparse until data blocks are modified
+    ofstream out(diskPath, ios::binary | ios::trunc);
+    if (!out) {
+        cerr << "Error: Cannot create overlay file '" << diskPath << "'\n";
+        return false;
+    }
+    out.seekp(static_cast<uint64_t>(sb.mapStartBlock + sb.mapBlockCount) * BLOCK_SIZE - 1);
+    constexpr char zero = '\0';
+    out.write(&zero, 1);
+    out.close();
+    std::remove((diskPath + STATS_SUFFIX).c_str());
+    std::remove((diskPath + HEAT_SUFFIX).c_str());
+
     disk.open(diskPath, ios::binary | ios::in | ios::out);
+    if (!disk) {
+        cerr << "Error: Cannot open overlay file after creation\n";
+        return false;
+    }
+    writeSuperblock();
+    writeDirectory();
+    writeFAT();
+    disk.close();
+
+    cout << "Overlay '" << diskPath << "' created on top of '" << basePath << "' ("
+            << sb.totalBlocks << " blocks).\n";
+    return true;
+}
+
+// Load an existing virtual disk (read superblock, directory, FAT into memory)
+bool VirtualFileSystem::loadDisk(const bool readOnly) {
+    PROFILE_SCOPE("loadDisk");
+    this->readOnly = readOnly;
+    disk.open(diskPath, readOnly ? ios::binary | ios::in : ios::binary | ios::in | ios::out);
     if (!disk) {
         cerr << "Error: Cannot open virtual disk '" << diskPath << "'\n";
         return false;
     }
+    if (!lockDisk()) {
+        cerr << "Error: Cannot lock virtual disk '" << diskPath << "'\n";
+        disk.close();
+        return false;
+    }
     if (!readSuperblock()) {
         cerr << "Error: Invalid or corrupt superblock\n";
         disk.close();
@@ -111,13 +309,343 @@ bool VirtualFileSystem::loadDisk() {
     }
     readDirectory();
     readFAT();
+    if (sb.imageType == IMAGE_OVERLAY) {
+        readBlockMap();
+        if (!openBase(true)) {
+            disk.close();
+            return false;
+        }
+    } else if (sb.imageType == IMAGE_STRIPED || sb.imageType == IMAGE_MIRRORED || sb.imageType == IMAGE_PARITY ||
+               sb.imageType == IMAGE_SPLIT || sb.imageType == IMAGE_TIERED) {
+        if (sb.imageType == IMAGE_MIRRORED) readChecksums();
+        if (sb.imageType == IMAGE_TIERED) readTierTable();
+        if (!openMembers(readOnly)) {
+            disk.close();
+            return false;
+        }
+    } else if (sb.imageType != IMAGE_PLAIN) {
+        cerr << "Error: Unsupported image type " << sb.imageType << "\n";
+        disk.close();
+        return false;
+    }
+    return true;
+}
+
+// A loaded overlay holds a shared lock on every base below it, so a command writing one of those
+// bases while the overlay is loaded would wait on itself
+bool VirtualFileSystem::isBackedBy(const std::string &otherPath) const {
+    string path = diskPath;
+    for (uint32_t depth = 0; depth < 16; ++depth) {    // Bounded, in case someone made a cycle by hand
+        ifstream in(path, ios::binary);
+        SuperBlock block{};
+        if (!in.read(reinterpret_cast<char *>(&block), sizeof(block)) ||
+            strncmp(block.fsName, FS_NAME, strlen(FS_NAME)) != 0 || block.imageType != IMAGE_OVERLAY) {
+            return false;
+        }
+        filesystem::path base(string(block.basePath, strnlen(block.basePath, sizeof(block.basePath))));
+        if (base.is_relative()) base = filesystem::path(path).parent_path() / base;
+        path = base.string();
+        if (error_code ec; filesystem::equivalent(path, otherPath, ec)) return true;
+    }
+    return false;
+}
+
+// Lock the disk file, shared for read-only loads and exclusive otherwise, until this object goes away
+// Commands on the same disk then take turns instead of writing back each other's stale directory and FAT
+bool VirtualFileSystem::lockDisk() {
+    if (lockFd < 0) lockFd = open(diskPath.c_str(), O_RDONLY | O_CLOEXEC);  // A second load converts the lock
+    if (lockFd < 0) return false;
+    const int mode = readOnly ? LOCK_SH : LOCK_EX;
+    if (flock(lockFd, mode | LOCK_NB) != 0) {
+        // Only waits are recorded, an uncontended lock would give every load something to write to .stats
+        MetricTimer timer(stats, METRIC_LOCK);
+        PROFILE_SPAN("disk lock", "wait");
+        int result;
+        while ((result = flock(lockFd, mode)) != 0 && errno == EINTR) {
+        }
+        if (result != 0) {
+            close(lockFd);
+            lockFd = -1;
+            return false;
+        }
+        timer.done();
+    }
+    return true;
+}
+
+// Backing file paths (overlay base, members) are relative to the directory of this disk,
+// like qcow2 backing files
+std::string VirtualFileSystem::resolveBackingPath(const char *name, const size_t maxLen) const {
+    const filesystem::path path(string(name, strnlen(name, maxLen)));
+    if (path.is_absolute()) return path.string();
+    return (filesystem::path(diskPath).parent_path() / path).string();
+}
+
+// Open the base image of an overlay and check it still matches our geometry
+bool VirtualFileSystem::openBase(const bool readOnly) {
+    PROFILE_SCOPE("openBase");
+    base = make_unique<VirtualFileSystem>(resolveBackingPath(sb.basePath, sizeof(sb.basePath)));
+    if (!base->loadDisk(readOnly)) {
+        cerr << "Error: Cannot load base image '" << sb.basePath << "'\n";
+        base.reset();
+        return false;
+    }
+    if (sb.imageType == IMAGE_OVERLAY &&
+        (base->sb.totalBlocks != sb.totalBlocks || base->sb.dataStartBlock != sb.dataStartBlock)) {
+        cerr << "Error: Base image '" << sb.basePath << "' does not match the overlay geometry\n";
+        base.reset();
+        return false;
+    }
+    return true;
+}
+
+// Write every block held by the overlay, plus its directory and FAT, into the base image
+bool VirtualFileSystem::commitOverlay() {
+    PROFILE_SCOPE("commitOverlay");
+    if (sb.imageType != IMAGE_OVERLAY) {
+        cerr << "Error: '" << diskPath << "' is not an overlay\n";
+        return false;
+    }
+    // Reopen the base for writing (it is only read-only while the overlay is in use)
+    if (!openBase(false)) return false;
+
+    uint32_t merged = 0;
+    char buffer[BLOCK_SIZE];
+    for (uint32_t i = sb.dataStartBlock; i < sb.totalBlocks; ++i) {
+        // Blocks freed since they were written hold nothing worth keeping
+        if (!(blockMap[i / 8] & (1 << (i % 8))) || FAT[i] == FAT_FREE) continue;
+        if (!readDataBlock(i, buffer) || !base->writeDataBlock(i, buffer)) {
+            cerr << "Error: Failed to merge block " << i << " into base image\n";
+            return false;
+        }
+        ++merged;
+    }
+    base->directory = directory;
+    base->FAT = FAT;
+    if (!base->writeDirectory() || !base->writeFAT()) {
+        cerr << "Error: Failed to write metadata to base image\n";
+        return false;
+    }
+
+    // The overlay is now identical to its base
+    fill(blockMap.begin(), blockMap.end(), 0);
+    writeBlockMap();
+
+    cout << "Committed " << merged << " blocks from '" << diskPath << "' into '" << sb.basePath << "'.\n";
+    return true;
+}
+
+// Grow the disk, keeping every data block where it is
+// If the bigger FAT doesn't fit its current blocks, it is written to the new tail of the disk
+// and the superblock is switched over to it afterwards, so a crash leaves the old FAT in use
+bool VirtualFileSystem::growDisk(uint32_t newSize) {
+    PROFILE_SCOPE("growDisk");
+    if (sb.imageType != IMAGE_PLAIN) {
+        cerr << "Error: Only plain disks can be grown\n";
+        return false;
+    }
+    if (newSize % BLOCK_SIZE != 0) {
+        newSize = ((newSize / BLOCK_SIZE) + 1) * BLOCK_SIZE;
+    }
+    const uint32_t oldTotal = sb.totalBlocks;
+    const uint32_t newTotal = newSize / BLOCK_SIZE;
+    if (newTotal <= oldTotal) {
+        cerr << "Error: New size must be larger than the current " << oldTotal * BLOCK_SIZE << " bytes\n";
+        return false;
+    }
+
+    const uint32_t newFatCount = (newTotal * sizeof(int32_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const bool relocate = newFatCount > sb.fatBlockCount;
+    if (relocate && newTotal - newFatCount < oldTotal) {
+        cerr << "Error: Not enough new space for the enlarged FAT, grow by at least "
+                << (newFatCount + 1) * BLOCK_SIZE << " bytes\n";
+        return false;
+    }
+
+    // Extend the host file first, nothing points at the new blocks yet
+    disk.flush();
+    error_code ec;
+    filesystem::resize_file(diskPath, static_cast<uint64_t>(newTotal) * BLOCK_SIZE, ec);
+    if (ec) {
+        cerr << "Error: Cannot extend disk file '" << diskPath << "': " << ec.message() << "\n";
+        return false;
+    }
+
+    FAT.resize(newTotal, FAT_FREE);
+    if (relocate) {
+        // The old FAT blocks become ordinary free data blocks
+        for (uint32_t i = sb.fatStartBlock; i < sb.fatStartBlock + sb.fatBlockCount; ++i) {
+            FAT[i] = FAT_FREE;
+        }
+        sb.fatStartBlock = newTotal - newFatCount;
+        sb.fatBlockCount = newFatCount;
+        for (uint32_t i = sb.fatStartBlock; i < newTotal; ++i) {
+            FAT[i] = FAT_RESERVED;
+        }
+        // Data can now start right after the directory, reserved FAT blocks are skipped anyway
+        sb.dataStartBlock = sb.dirStartBlock + sb.dirBlockCount;
+    }
+    sb.totalBlocks = newTotal;
+
+    // New FAT first, then the superblock that refers to it
+    if (!writeFAT() || !syncDisk() || !writeSuperblock() || !syncDisk()) {
+        cerr << "Error: Failed to write grown metadata\n";
+        return false;
+    }
+
+    cout << "Virtual disk '" << diskPath << "' grown to " << newSize << " bytes, "
+            << newTotal << " blocks" << (relocate ? " (FAT relocated)" : "") << ".\n";
     return true;
 }
 
+// Shrink the disk by moving the blocks past the new end (and in the way of the FAT) further down
+// The updated chains are written to the old FAT before the new FAT and superblock,
+// so an interrupted shrink leaves a consistent disk with the old size
+bool VirtualFileSystem::shrinkDisk(uint32_t newSize) {
+    PROFILE_SCOPE("shrinkDisk");
+    if (sb.imageType != IMAGE_PLAIN) {
+        cerr << "Error: Only plain disks can be shrunk\n";
+        return false;
+    }
+    const uint32_t oldTotal = sb.totalBlocks;
+    const uint32_t dirEnd = sb.dirStartBlock + sb.dirBlockCount;
+
+    // Where the FAT of an n-block disk goes: kept in place if it still fits,
+    // otherwise moved back to right after the directory
+    auto fatCountFor = [](const uint32_t n) { return (n * sizeof(int32_t) + BLOCK_SIZE - 1) / BLOCK_SIZE; };
+    auto fatStartFor = [&](const uint32_t n) {
+        return sb.fatStartBlock + fatCountFor(n) <= n ? sb.fatStartBlock : dirEnd;
+    };
+    // An n-block disk works if every block in the way of the new end or the new FAT has a free
+    // block to go to. The old FAT blocks are not reused, they are still the live FAT until the end
+    auto fits = [&](const uint32_t n) {
+        const uint32_t fatStart = fatStartFor(n), fatEnd = fatStart + fatCountFor(n);
+        uint32_t toMove = 0, freeBlocks = 0;
+        for (uint32_t i = dirEnd; i < oldTotal; ++i) {
+            const bool inFat = i >= fatStart && i < fatEnd;
+            if (FAT[i] == FAT_FREE) {
+                if (i < n && !inFat) ++freeBlocks;
+            } else if (FAT[i] != FAT_RESERVED && (i >= n || inFat)) {
+                ++toMove;
+            }
+        }
+        return fatEnd <= n && toMove <= freeBlocks;
+    };
+
+    // Smallest disk that fits, found by bisection (the old size always fits)
+    uint32_t low = 4096 / BLOCK_SIZE, high = oldTotal;
+    while (low < high) {
+        if (const uint32_t mid = low + (high - low) / 2; fits(mid)) high = mid;
+        else low = mid + 1;
+    }
+    const uint32_t minTotal = low;
+
+    if (newSize % BLOCK_SIZE != 0) {
+        newSize = ((newSize / BLOCK_SIZE) + 1) * BLOCK_SIZE;
+    }
+    const uint32_t newTotal = newSize == 0 ? minTotal : newSize / BLOCK_SIZE;
+    if (newSize == 0 && minTotal >= oldTotal) {
+        cerr << "Error: Disk is already as small as its files allow (" << oldTotal * BLOCK_SIZE << " bytes)\n";
+        return false;
+    }
+    if (newTotal >= oldTotal) {
+        cerr << "Error: New size must be smaller than the current " << oldTotal * BLOCK_SIZE
+                << " bytes (dgrow makes disks bigger)\n";
+        return false;
+    }
+    if (!fits(newTotal)) {
+        cerr << "Error: Files need the disk to be at least " << minTotal * BLOCK_SIZE << " bytes\n";
+        return false;
+    }
+
+    const uint32_t newFatCount = fatCountFor(newTotal);
+    const uint32_t newFatStart = fatStartFor(newTotal);
+    auto inNewFat = [&](const uint32_t i) { return i >= newFatStart && i < newFatStart + newFatCount; };
+
+    // Predecessor of every block in a chain, or the directory entry it starts
+    vector<int32_t> prev(oldTotal, -1);
+    vector<int> headOf(oldTotal, -1);
+    for (int d = 0; d < static_cast<int>(directory.size()); ++d) {
+        if (directory[d].name[0] == '\0') continue;
+        int32_t blk = static_cast<int32_t>(directory[d].firstBlock);
+        headOf[blk] = d;
+        while (FAT[blk] > 0) {
+            prev[FAT[blk]] = blk;
+            blk = FAT[blk];
+        }
+    }
+
+    // Move every file block that is in the way into the lowest free block that is not
+    char buffer[BLOCK_SIZE];
+    uint32_t target = dirEnd;
+    uint32_t moved = 0;
+    for (uint32_t i = dirEnd; i < oldTotal; ++i) {
+        if (FAT[i] == FAT_FREE || FAT[i] == FAT_RESERVED) continue;
+        if (i < newTotal && !inNewFat(i)) continue;
+        while (FAT[target] != FAT_FREE || inNewFat(target)) ++target;
+        if (!readDataBlock(i, buffer) || !writeDataBlock(target, buffer)) {
+            cerr << "Error: Failed to move block " << i << "\n";
+            return false;
+        }
+        FAT[target] = FAT[i];
+        if (FAT[i] > 0) prev[FAT[i]] = static_cast<int32_t>(target);
+        if (prev[i] >= 0) FAT[prev[i]] = static_cast<int32_t>(target);
+        else directory[headOf[i]].firstBlock = target;
+        FAT[i] = FAT_FREE;
+        ++moved;
+    }
+
+    // Step 1: updated chains, still in the old geometry
+    if (!writeDirectory() || !writeFAT() || !syncDisk()) {
+        cerr << "Error: Failed to write relocated metadata\n";
+        return false;
+    }
+
+    // Step 2: new FAT, then the superblock that refers to it
+    for (uint32_t i = sb.fatStartBlock; i < sb.fatStartBlock + sb.fatBlockCount && i < newTotal; ++i) {
+        FAT[i] = FAT_FREE;
+    }
+    FAT.resize(newTotal);
+    for (uint32_t i = newFatStart; i < newFatStart + newFatCount; ++i) {
+        FAT[i] = FAT_RESERVED;
+    }
+    sb.totalBlocks = newTotal;
+    sb.fatStartBlock = newFatStart;
+    sb.fatBlockCount = newFatCount;
+    sb.dataStartBlock = newFatStart == dirEnd ? newFatStart + newFatCount : dirEnd;
+    if (!writeFAT() || !syncDisk() || !writeSuperblock() || !syncDisk()) {
+        cerr << "Error: Failed to write shrunk metadata\n";
+        return false;
+    }
+
+    // Step 3: nothing refers to the tail any more
+    error_code ec;
+    filesystem::resize_file(diskPath, static_cast<uint64_t>(newTotal) * BLOCK_SIZE, ec);
+    if (ec) {
+        cerr << "Warning: Cannot truncate disk file '" << diskPath << "': " << ec.message() << "\n";
+    }
+
+    cout << "Virtual disk '" << diskPath << "' shrunk to " << newTotal * BLOCK_SIZE << " bytes, "
+            << newTotal << " blocks (" << moved << " blocks moved).\n";
+    return true;
+}
+
+// Flush the stream and force the written data to the storage device
+bool VirtualFileSystem::syncDisk() {
+    PROFILE_SCOPE("syncDisk");
+    disk.flush();
+    const int fd = open(diskPath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    const bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok && disk.good();
+}
+
 // Read superblock from disk
 bool VirtualFileSystem::readSuperblock() {
     disk.seekg(0);
     disk.read(reinterpret_cast<char *>(&sb), sizeof(sb));
+    ioAccount(diskIo, IO_SUPERBLOCK, false, 0, sizeof(sb));
     // Verify filesystem identifier
     if (strncmp(sb.fsName, FS_NAME, strlen(FS_NAME)) != 0) {
         return false;
@@ -134,19 +662,24 @@ bool VirtualFileSystem::writeSuperblock() {
         const vector<char> pad(BLOCK_SIZE - sizeof(sb), 0);
         disk.write(pad.data(), pad.size());
     }
+    ioAccount(diskIo, IO_SUPERBLOCK, true, 0, BLOCK_SIZE, sizeof(sb) < BLOCK_SIZE ? 2 : 1);
     return disk.good();
 }
 
 // Read directory entries from disk
 bool VirtualFileSystem::readDirectory() {
+    PROFILE_SCOPE("readDirectory");
     directory.assign(MAX_FILES, DirEntry());
     disk.seekg(sb.dirStartBlock * BLOCK_SIZE);
     disk.read(reinterpret_cast<char *>(directory.data()), MAX_FILES * sizeof(DirEntry));
+    ioAccount(diskIo, IO_DIRECTORY, false, sb.dirStartBlock * BLOCK_SIZE, MAX_FILES * sizeof(DirEntry));
     return disk.good();
 }
 
 // Write directory entries to disk
 bool VirtualFileSystem::writeDirectory() {
+    PROFILE_SCOPE("writeDirectory");
+    MetricTimer timer(stats, METRIC_FLUSH);
     disk.seekp(sb.dirStartBlock * BLOCK_SIZE);
     disk.write(reinterpret_cast<char *>(directory.data()), MAX_FILES * sizeof(DirEntry));
     // Pad the rest of directory blocks
@@ -155,19 +688,27 @@ bool VirtualFileSystem::writeDirectory() {
         const vector<char> pad(totalBytes - usedBytes, 0);
         disk.write(pad.data(), pad.size());
     }
-    return disk.good();
+    ioAccount(diskIo, IO_DIRECTORY, true, sb.dirStartBlock * BLOCK_SIZE, sb.dirBlockCount * BLOCK_SIZE,
+              usedBytes < sb.dirBlockCount * BLOCK_SIZE ? 2 : 1);
+    if (!disk.good()) return false;
+    timer.done(sb.dirBlockCount * BLOCK_SIZE);
+    return true;
 }
 
 // Read FAT from disk
 bool VirtualFileSystem::readFAT() {
+    PROFILE_SCOPE("readFAT");
     FAT.assign(sb.totalBlocks, FAT_FREE);
     disk.seekg(sb.fatStartBlock * BLOCK_SIZE);
     disk.read(reinterpret_cast<char *>(FAT.data()), sb.totalBlocks * sizeof(int32_t));
+    ioAccount(diskIo, IO_FAT, false, sb.fatStartBlock * BLOCK_SIZE, sb.totalBlocks * sizeof(int32_t));
     return disk.good();
 }
 
 // Write FAT to disk
 bool VirtualFileSystem::writeFAT() {
+    PROFILE_SCOPE("writeFAT");
+    MetricTimer timer(stats, METRIC_FLUSH);
     disk.seekp(sb.fatStartBlock * BLOCK_SIZE);
     disk.write(reinterpret_cast<char *>(FAT.data()), sb.totalBlocks * sizeof(int32_t));
     // Pad the rest of FAT blocks
@@ -176,18 +717,79 @@ bool VirtualFileSystem::writeFAT() {
         const vector<char> pad(totalBytes - usedBytes, 0);
         disk.write(pad.data(), pad.size());
     }
+    ioAccount(diskIo, IO_FAT, true, sb.fatStartBlock * BLOCK_SIZE, sb.fatBlockCount * BLOCK_SIZE,
+              usedBytes < sb.fatBlockCount * BLOCK_SIZE ? 2 : 1);
+    // The block map of an overlay, the checksums of a mirror and the tier table change together with the FAT
+    bool ok = disk.good();
+    if (sb.imageType == IMAGE_OVERLAY) {
+        ok = writeBlockMap();
+    } else if (sb.imageType == IMAGE_MIRRORED) {
+        ok = writeChecksums();
+    } else if (sb.imageType == IMAGE_TIERED) {
+        ok = writeTierTable();
+    }
+    if (ok) timer.done(static_cast<uint64_t>(sb.fatBlockCount) * BLOCK_SIZE);
+    return ok;
+}
+
+// Read the overlay block map from disk
+bool VirtualFileSystem::readBlockMap() {
+    blockMap.assign(sb.mapBlockCount * BLOCK_SIZE, 0);
+    disk.seekg(static_cast<uint64_t>(sb.mapStartBlock) * BLOCK_SIZE);
+    disk.read(reinterpret_cast<char *>(blockMap.data()), blockMap.size());
+    ioAccount(diskIo, IO_TABLES, false, static_cast<uint64_t>(sb.mapStartBlock) * BLOCK_SIZE, blockMap.size());
+    return disk.good();
+}
+
+// Write the overlay block map to disk
+bool VirtualFileSystem::writeBlockMap() {
+    disk.seekp(static_cast<uint64_t>(sb.mapStartBlock) * BLOCK_SIZE);
+    disk.write(reinterpret_cast<char *>(blockMap.data()), blockMap.size());
+    ioAccount(diskIo, IO_TABLES, true, static_cast<uint64_t>(sb.mapStartBlock) * BLOCK_SIZE, blockMap.size());
+    return disk.good();
+}
+
+// Read one data block; overlays fall through to the base for blocks they don't hold
+bool VirtualFileSystem::readDataBlock(const uint32_t blk, char *buffer) {
+    if (sb.imageType == IMAGE_OVERLAY && !(blockMap[blk / 8] & (1 << (blk % 8)))) {
+        return base->readDataBlock(blk, buffer);
+    }
+    if (sb.memberCount > 0) {
+        return readDataBlocks({static_cast<int32_t>(blk)}, buffer);
+    }
+    disk.seekg(static_cast<uint64_t>(blk) * BLOCK_SIZE);
+    disk.read(buffer, BLOCK_SIZE);
+    ioAccount(diskIo, IO_DATA, false, static_cast<uint64_t>(blk) * BLOCK_SIZE, BLOCK_SIZE);
+    return disk.good();
+}
+
+// Write one data block; overlays remember that the block now lives in them
+bool VirtualFileSystem::writeDataBlock(const uint32_t blk, const char *buffer) {
+    if (sb.memberCount > 0) {
+        return writeDataBlocks({static_cast<int32_t>(blk)}, buffer);
+    }
+    disk.seekp(static_cast<uint64_t>(blk) * BLOCK_SIZE);
+    disk.write(buffer, BLOCK_SIZE);
+    ioAccount(diskIo, IO_DATA, true, static_cast<uint64_t>(blk) * BLOCK_SIZE, BLOCK_SIZE);
+    if (sb.imageType == IMAGE_OVERLAY) {
+        blockMap[blk / 8] |= static_cast<uint8_t>(1 << (blk % 8));
+    }
     return disk.good();
 }
 
 // Find 'count' free blocks in FAT; return true if found and fill 'blocks' vector
 bool VirtualFileSystem::findFreeBlocks(const uint32_t count, vector<int32_t> &blocks) const {
+    PROFILE_SCOPE("findFreeBlocks");
+    MetricTimer timer(stats, METRIC_ALLOC);
     blocks.clear();
     for (uint32_t i = sb.dataStartBlock; i < sb.totalBlocks && blocks.size() < count; ++i) {
         if (FAT[i] == FAT_FREE) {
             blocks.push_back(i);
         }
     }
-    return (blocks.size() == count);
+    if (blocks.size() != count) return false;
+    timer.done(static_cast<uint64_t>(count) * BLOCK_SIZE);
+    return true;
 }
 
 // Find directory entry index by file name; return -1 if not found
@@ -202,6 +804,8 @@ int VirtualFileSystem::findDirectoryEntry(const string &name) const {
 
 // Copy a host file into the virtual disk
 bool VirtualFileSystem::copyFromHost(const std::string &hostFile) {
+    PROFILE_SCOPE("copyFromHost");
+    MetricTimer timer(stats, METRIC_PUT);
     // Determine file name (strip path)
     size_t pos = hostFile.find_last_of("/\\");
     string fname = (pos == string::npos ? hostFile : hostFile.substr(pos + 1));
@@ -266,34 +870,43 @@ bool VirtualFileSystem::copyFromHost(const std::string &hostFile) {
         }
     }
 
-    // Write file data into data blocks
-    char buffer[BLOCK_SIZE];
-    for (uint32_t i = 0; i < blocksNeeded; ++i) {
-        int blk = blocks[i];
-        disk.seekp((uint64_t) blk * BLOCK_SIZE);
-        // Compute bytes to read for this block
-        uint32_t bytesToRead = static_cast<uint32_t>(min(static_cast<streamsize>(BLOCK_SIZE),
-                                                         fileSize - static_cast<streamsize>(i) * BLOCK_SIZE));
-        in.read(buffer, bytesToRead);
-        disk.write(buffer, bytesToRead);
-        // Pad remainder of block with zeros if last block not full
-        if (bytesToRead < BLOCK_SIZE) {
-            vector<char> pad(BLOCK_SIZE - bytesToRead, 0);
-            disk.write(pad.data(), pad.size());
+    // Write file data into data blocks, a batch at a time
+    vector<char> buffer(IO_BATCH_BLOCKS * BLOCK_SIZE);
+    for (uint32_t first = 0; first < blocksNeeded; first += IO_BATCH_BLOCKS) {
+        const uint32_t count = min(IO_BATCH_BLOCKS, blocksNeeded - first);
+        // Compute bytes to read for this batch
+        const auto bytesToRead = static_cast<uint32_t>(min(static_cast<streamsize>(count) * BLOCK_SIZE,
+                                                           fileSize - static_cast<streamsize>(first) * BLOCK_SIZE));
+        {
+            PROFILE_SCOPE("host read");
+            in.read(buffer.data(), bytesToRead);
+        }
+        // Pad remainder of the last block with zeros if it's not full
+        memset(buffer.data() + bytesToRead, 0, count * BLOCK_SIZE - bytesToRead);
+        const vector<int32_t> batch(blocks.begin() + first, blocks.begin() + first + count);
+        if (!writeDataBlocks(batch, buffer.data())) {
+            cerr << "Error: Failed to write data blocks to virtual disk\n";
+            return false;
         }
     }
     in.close();
+    heat.sample(fname, blocks);
 
     // Save updated metadata (directory and FAT)
     writeDirectory();
     writeFAT();
 
+    traceOp(TRACE_CREATE, fname, 0, static_cast<uint64_t>(fileSize));
+    ioLogical(true, static_cast<uint64_t>(fileSize));
+    timer.done(static_cast<uint64_t>(fileSize));
     cout << "Copied '" << fname << "' (" << fileSize << " bytes) to virtual disk.\n";
     return true;
 }
 
 // Copy a file from the virtual disk to host filesystem
 bool VirtualFileSystem::copyToHost(const std::string &fileName, const std::string &destPath) {
+    PROFILE_SCOPE("copyToHost");
+    MetricTimer timer(stats, METRIC_GET);
     const int idx = findDirectoryEntry(fileName);
     if (idx < 0) {
         cerr << "Error: File '" << fileName << "' not found in virtual disk\n";
@@ -309,32 +922,192 @@ bool VirtualFileSystem::copyToHost(const std::string &fileName, const std::strin
         return false;
     }
 
-    // Follow FAT chain and write blocks
-    int32_t blk = entry.firstBlock;
+    // Follow FAT chain, then read the blocks a batch at a time
+    vector<int32_t> chain;
+    for (int32_t blk = entry.firstBlock; blk >= 0 && chain.size() * BLOCK_SIZE < entry.size; blk = FAT[blk]) {
+        chain.push_back(blk);
+    }
     uint64_t remaining = entry.size;
-    char buffer[BLOCK_SIZE];
-    while (blk != FAT_EOF && remaining > 0) {
-        disk.seekg((uint64_t) blk * BLOCK_SIZE);
-        const uint32_t toRead = static_cast<uint32_t>(min(static_cast<uint64_t>(BLOCK_SIZE), remaining));
-        disk.read(buffer, toRead);
-        out.write(buffer, toRead);
-        remaining -= toRead;
-        blk = (blk < 0 ? FAT_EOF : FAT[blk]);
+    vector<char> buffer(IO_BATCH_BLOCKS * BLOCK_SIZE);
+    for (size_t first = 0; first < chain.size() && remaining > 0; first += IO_BATCH_BLOCKS) {
+        const size_t count = min(static_cast<size_t>(IO_BATCH_BLOCKS), chain.size() - first);
+        const vector<int32_t> batch(chain.begin() + first, chain.begin() + first + count);
+        if (!readDataBlocks(batch, buffer.data())) {
+            cerr << "Error: Failed to read data blocks from virtual disk\n";
+            return false;
+        }
+        const auto toWrite = static_cast<uint32_t>(min(static_cast<uint64_t>(count) * BLOCK_SIZE, remaining));
+        {
+            PROFILE_SCOPE("host write");
+            out.write(buffer.data(), toWrite);
+        }
+        remaining -= toWrite;
     }
     out.close();
+    heat.sample(fileName, chain);
+
+    // Reads make blocks hotter, which the tier migration needs to know about
+    if (sb.imageType == IMAGE_TIERED && !readOnly) {
+        writeTierTable();
+    }
 
+    traceOp(TRACE_READ, fileName, 0, entry.size);
+    ioLogical(false, entry.size);
+    timer.done(entry.size);
     cout << "Copied '" << fileName << "' from virtual disk to '" << outPath << "'.\n";
     return true;
 }
 
+// Copy len bytes between two files in the kernel, falling back to pread/pwrite where copy_file_range
+// can't be used (old kernels, some filesystems)
+static bool copyRange(const int from, uint64_t fromOffset, const int to, uint64_t toOffset, size_t len) {
+    while (len > 0) {
+        auto in = static_cast<off64_t>(fromOffset), out = static_cast<off64_t>(toOffset);
+        ssize_t done = copy_file_range(from, &in, to, &out, len, 0);
+        if (done < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+            char buffer[IO_BATCH_BLOCKS * BLOCK_SIZE];
+            done = pread(from, buffer, min(len, sizeof(buffer)), static_cast<off_t>(fromOffset));
+            if (done > 0 && pwrite(to, buffer, done, static_cast<off_t>(toOffset)) != done) return false;
+        }
+        if (done <= 0) return false;
+        fromOffset += done;
+        toOffset += done;
+        len -= done;
+    }
+    return true;
+}
+
+// Copy a file straight into another virtual disk, without going through a host file
+// Data goes first (kernel-side per contiguous run when both disks have fixed block places),
+// the destination's directory and FAT are written once at the end
+bool VirtualFileSystem::copyToDisk(const std::string &fileName, VirtualFileSystem &dest, const std::string &newName) {
+    PROFILE_SCOPE("copyToDisk");
+    MetricTimer timer(stats, METRIC_GET), destTimer(dest.stats, METRIC_PUT);
+    const int idx = findDirectoryEntry(fileName);
+    if (idx < 0) {
+        cerr << "Error: File '" << fileName << "' not found in virtual disk\n";
+        return false;
+    }
+    const DirEntry &entry = directory[idx];
+    const string name = newName.empty() ? fileName : newName;
+    if (name.size() >= sizeof(entry.name)) {
+        cerr << "Error: File name '" << name << "' is too long\n";
+        return false;
+    }
+    if (dest.findDirectoryEntry(name) >= 0) {
+        cerr << "Error: File '" << name << "' already exists in virtual disk '" << dest.diskPath << "'\n";
+        return false;
+    }
+    int freeSlot = -1;
+    for (uint32_t i = 0; i < MAX_FILES; ++i) {
+        if (dest.directory[i].name[0] == '\0') {
+            freeSlot = static_cast<int>(i);
+            break;
+        }
+    }
+    if (freeSlot < 0) {
+        cerr << "Error: Directory is full (max " << MAX_FILES << " files)\n";
+        return false;
+    }
+
+    vector<int32_t> chain;
+    for (int32_t blk = entry.firstBlock; blk >= 0 && chain.size() * BLOCK_SIZE < entry.size; blk = FAT[blk]) {
+        chain.push_back(blk);
+    }
+    vector<int32_t> blocks;
+    if (chain.empty() || !dest.findFreeBlocks(static_cast<uint32_t>(chain.size()), blocks)) {
+        cerr << "Error: Not enough free space on virtual disk '" << dest.diskPath << "'\n";
+        return false;
+    }
+
+    // Both sides have every block at a fixed file offset: copy runs that are contiguous on both sides
+    vector<tuple<string, uint64_t, string, uint64_t> > places(chain.size());
+    bool direct = true;
+    for (size_t i = 0; i < chain.size() && direct; ++i) {
+        auto &[fromPath, fromOffset, toPath, toOffset] = places[i];
+        direct = blockLocation(chain[i], fromPath, fromOffset) && dest.blockLocation(blocks[i], toPath, toOffset);
+    }
+    bool ok = true;
+    if (direct) {
+        map<pair<string, int>, int> fds;
+        map<pair<string, int>, IoCursor> cursors;
+        auto fdFor = [&](const string &path, const int flags) {
+            if (const auto it = fds.find({path, flags}); it != fds.end()) return it->second;
+            return fds[{path, flags}] = open(path.c_str(), flags);
+        };
+        for (size_t first = 0; first < places.size() && ok;) {
+            const auto &[fromPath, fromOffset, toPath, toOffset] = places[first];
+            size_t last = first + 1;
+            while (last < places.size() && get<0>(places[last]) == fromPath && get<2>(places[last]) == toPath &&
+                   get<1>(places[last]) == fromOffset + (last - first) * BLOCK_SIZE &&
+                   get<3>(places[last]) == toOffset + (last - first) * BLOCK_SIZE) {
+                ++last;
+            }
+            const int from = fdFor(fromPath, O_RDONLY), to = fdFor(toPath, O_WRONLY);
+            ok = from >= 0 && to >= 0 && copyRange(from, fromOffset, to, toOffset, (last - first) * BLOCK_SIZE);
+            // copy_file_range never hands the data to us, count it here
+            ioAccount(cursors[{fromPath, O_RDONLY}], IO_DATA, false, fromOffset, (last - first) * BLOCK_SIZE);
+            ioAccount(cursors[{toPath, O_WRONLY}], IO_DATA, true, toOffset, (last - first) * BLOCK_SIZE);
+            first = last;
+        }
+        for (const auto &fd: fds) {
+            if (fd.second >= 0) close(fd.second);
+        }
+    } else {
+        vector<char> buffer(IO_BATCH_BLOCKS * BLOCK_SIZE);
+        for (size_t first = 0; first < chain.size() && ok; first += IO_BATCH_BLOCKS) {
+            const size_t count = min(static_cast<size_t>(IO_BATCH_BLOCKS), chain.size() - first);
+            const vector<int32_t> from(chain.begin() + first, chain.begin() + first + count);
+            const vector<int32_t> to(blocks.begin() + first, blocks.begin() + first + count);
+            ok = readDataBlocks(from, buffer.data()) && dest.writeDataBlocks(to, buffer.data());
+        }
+    }
+    if (!ok) {
+        cerr << "Error: Failed to copy data blocks to virtual disk '" << dest.diskPath << "'\n";
+        return false;
+    }
+    heat.sample(fileName, chain);
+    dest.heat.sample(name, blocks);
+
+    // Commit the destination's metadata in one go
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        dest.FAT[blocks[i]] = i + 1 < blocks.size() ? blocks[i + 1] : FAT_EOF;
+    }
+    DirEntry &copy = dest.directory[freeSlot];
+    memset(&copy, 0, sizeof(DirEntry));
+    strncpy(copy.name, name.c_str(), sizeof(copy.name) - 1);
+    copy.size = entry.size;
+    copy.created = time(nullptr);
+    copy.type = entry.type;
+    copy.firstBlock = blocks[0];
+    dest.writeDirectory();
+    dest.writeFAT();
+    if (sb.imageType == IMAGE_TIERED && !readOnly) {
+        writeTierTable();
+    }
+
+    traceOp(TRACE_READ, fileName, 0, entry.size);
+    dest.traceOp(TRACE_CREATE, name, 0, entry.size);
+    ioLogical(false, entry.size);
+    ioLogical(true, entry.size);
+    timer.done(entry.size);
+    destTimer.done(entry.size);
+    cout << "Copied '" << fileName << "' (" << entry.size << " bytes) to '" << name << "' on '" << dest.diskPath
+            << "'.\n";
+    return true;
+}
+
 // Delete a file from the virtual disk
 bool VirtualFileSystem::deleteFile(const std::string &fileName) {
+    PROFILE_SCOPE("deleteFile");
+    MetricTimer timer(stats, METRIC_DELETE);
     const int idx = findDirectoryEntry(fileName);
     if (idx < 0) {
         cerr << "Error: File '" << fileName << "' not found in virtual disk\n";
         return false;
     }
     DirEntry &entry = directory[idx];
+    const uint64_t size = entry.size;
     // Free all blocks in the file's chain
     int32_t blk = entry.firstBlock;
     while (blk != FAT_EOF && blk != FAT_RESERVED) {
@@ -349,89 +1122,381 @@ bool VirtualFileSystem::deleteFile(const std::string &fileName) {
     writeDirectory();
     writeFAT();
 
+    traceOp(TRACE_DELETE, fileName, 0, 0);
+    timer.done(size);
     cout << "Deleted file '" << fileName << "' from virtual disk.\n";
     return true;
 }
 
+// Rename a file, only the directory changes
+bool VirtualFileSystem::renameFile(const std::string &fileName, const std::string &newName) {
+    PROFILE_SCOPE("renameFile");
+    const int idx = findDirectoryEntry(fileName);
+    if (idx < 0) {
+        cerr << "Error: File '" << fileName << "' not found in virtual disk\n";
+        return false;
+    }
+    if (newName.empty() || newName.size() >= sizeof(directory[idx].name)) {
+        cerr << "Error: File name '" << newName << "' must be 1 to " << sizeof(directory[idx].name) - 1
+                << " characters\n";
+        return false;
+    }
+    if (findDirectoryEntry(newName) >= 0) {
+        cerr << "Error: File '" << newName << "' already exists in virtual disk\n";
+        return false;
+    }
+    DirEntry &entry = directory[idx];
+    memset(entry.name, 0, sizeof(entry.name));
+    strncpy(entry.name, newName.c_str(), sizeof(entry.name) - 1);
+    if (!writeDirectory()) {
+        cerr << "Error: Failed to write the directory\n";
+        return false;
+    }
+
+    traceOp(TRACE_RENAME, fileName, traceHash(newName), 0);
+    cout << "Renamed '" << fileName << "' to '" << newName << "'.\n";
+    return true;
+}
+
+// Look up a file's directory entry without touching its data
+bool VirtualFileSystem::statFile(const std::string &fileName, DirEntry &info) const {
+    const int idx = findDirectoryEntry(fileName);
+    if (idx < 0) {
+        cerr << "Error: File '" << fileName << "' not found in virtual disk\n";
+        return false;
+    }
+    info = directory[idx];
+    traceOp(TRACE_STAT, fileName, 0, 0);
+    return true;
+}
+
 // List all files in the virtual disk directory
-void VirtualFileSystem::listFiles() const {
-    cout << left << setw(20) << "Name"
-            << right << setw(10) << "Size" << "  "
-            << left << "Created               Type\n";
-    cout << string(20 + 10 + 2 + 19 + 6, '-') << "\n";
+// JSON and CSV carry exact sizes, epoch timestamps and the block extents of every file, and
+// are written entry by entry
+void VirtualFileSystem::listFiles(const uint32_t format) const {
+    PROFILE_SCOPE("listFiles");
+    MetricTimer timer(stats, METRIC_LIST);
+    if (format == FORMAT_JSON) {
+        cout << "{\"disk\":" << jsonString(diskPath) << ",\"block_size\":" << BLOCK_SIZE << ",\"files\":[";
+    } else if (format == FORMAT_CSV) {
+        cout << "name,size,created,type,blocks,extents\n";
+    } else {
+        cout << left << setw(20) << "Name"
+                << right << setw(10) << "Size" << "  "
+                << left << "Created               Type\n";
+        cout << string(20 + 10 + 2 + 19 + 6, '-') << "\n";
+    }
     bool any = false;
     for (const auto &entry: directory) {
         if (entry.name[0] == '\0') continue;
+        const string name(entry.name, strnlen(entry.name, sizeof(entry.name)));
+        if (format == FORMAT_TABLE) {
+            // Format creation time
+            const std::tm *tm_info = std::localtime(&entry.created);
+            char timestr[20];
+            std::strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", tm_info);
+            cout << left << setw(20) << entry.name
+                    << right << setw(10) << entry.size << "  "
+                    << left << timestr << "  "
+                    << entry.type << "\n";
+            any = true;
+            continue;
+        }
+
+        // Runs of consecutive blocks along the chain, first-last
+        vector<pair<uint32_t, uint32_t> > extents;
+        uint64_t blocks = 0;
+        for (int32_t blk = entry.firstBlock; blk >= 0 && blocks * BLOCK_SIZE < entry.size; blk = FAT[blk], ++blocks) {
+            if (!extents.empty() && extents.back().second + 1 == static_cast<uint32_t>(blk)) ++extents.back().second;
+            else extents.emplace_back(blk, blk);
+        }
+        if (format == FORMAT_JSON) {
+            cout << (any ? ",\n" : "\n") << "{\"name\":" << jsonString(name) << ",\"size\":" << entry.size
+                    << ",\"created\":" << static_cast<int64_t>(entry.created) << ",\"type\":"
+                    << jsonString(string(1, entry.type)) << ",\"blocks\":" << blocks << ",\"extents\":[";
+            for (size_t i = 0; i < extents.size(); ++i) {
+                cout << (i ? "," : "") << "[" << extents[i].first << "," << extents[i].second << "]";
+            }
+            cout << "]}";
+        } else {
+            cout << csvField(name) << "," << entry.size << "," << static_cast<int64_t>(entry.created) << ","
+                    << csvField(string(1, entry.type)) << "," << blocks << ",";
+            for (size_t i = 0; i < extents.size(); ++i) {
+                cout << (i ? " " : "") << extents[i].first << "-" << extents[i].second;
+            }
+            cout << "\n";
+        }
         any = true;
-        // Format creation time
-        const std::tm *tm_info = std::localtime(&entry.created);
-        char timestr[20];
-        std::strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", tm_info);
-        cout << left << setw(20) << entry.name
-                << right << setw(10) << entry.size << "  "
-                << left << timestr << "  "
-                << entry.type << "\n";
-    }
-    if (!any) {
+    }
+    if (format == FORMAT_JSON) {
+        cout << (any ? "\n" : "") << "]}\n";
+    } else if (!any && format == FORMAT_TABLE) {
         cout << "(no files)\n";
     }
+    timer.done();
 }
 
-// Show the occupancy map of blocks on the virtual disk
-void VirtualFileSystem::showMap() const {
-    cout << "Range            | Type           | Status\n";
-    cout << "-----------------------------------------------\n";
-
-    auto describe_block = [&](uint32_t i) -> pair<string, string> {
-        if (i == 0) return {"Superblock", "occupied"};
-        else if (i >= sb.dirStartBlock && i < sb.dirStartBlock + sb.dirBlockCount)
-            return {"Directory", "occupied"};
-        else if (i >= sb.fatStartBlock && i < sb.fatStartBlock + sb.fatBlockCount)
-            return {"FAT", "occupied"};
-        else {
-            if (FAT[i] == FAT_FREE) return {"Free", "free"};
-            else {
-                string fname;
-                for (const auto &entry: directory) {
-                    if (entry.name[0] == '\0') continue;
-                    int32_t blk = entry.firstBlock;
-                    while (blk != FAT_EOF && blk >= 0) {
-                        if (static_cast<uint32_t>(blk) == i) {
-                            fname = entry.name;
-                            break;
-                        }
-                        blk = FAT[blk];
-                    }
-                    if (!fname.empty()) break;
-                }
-                return !fname.empty()
-                           ? make_pair("File(" + fname + ")", "occupied")
-                           : make_pair("Unknown", "occupied");
-            }
+// Names of all files in the virtual disk directory
+std::vector<std::string> VirtualFileSystem::fileNames() const {
+    vector<string> names;
+    for (const auto &entry: directory) {
+        if (entry.name[0] != '\0') names.emplace_back(entry.name, strnlen(entry.name, sizeof(entry.name)));
+    }
+    return names;
+}
+
+// Show the occupancy map of blocks on the virtual disk, as ranges of blocks with the same use
+void VirtualFileSystem::showMap(const uint32_t format) const {
+    PROFILE_SCOPE("showMap");
+    // What a block is used for, with the names for the table and for JSON/CSV
+    enum Kind { SUPER, DIR, FAT_BLOCKS, SUMS, TIERS, FREE, FILE, UNKNOWN };
+    static const char *tableNames[] = {"Superblock", "Directory", "FAT", "Checksums", "Tier table", "Free", "File",
+                                       "Unknown"};
+    static const char *keys[] = {"superblock", "directory", "fat", "checksums", "tier_table", "free", "file",
+                                 "unknown"};
+
+    // The file owning every block, from one walk of each chain (the first file listed wins a shared block)
+    vector<int16_t> owner(sb.totalBlocks, -1);
+    for (size_t i = 0; i < directory.size(); ++i) {
+        if (directory[i].name[0] == '\0') continue;
+        uint32_t steps = 0;
+        for (int32_t blk = directory[i].firstBlock; blk != FAT_EOF && blk >= 0 &&
+                                                    static_cast<uint32_t>(blk) < sb.totalBlocks &&
+                                                    steps < sb.totalBlocks; blk = FAT[blk], ++steps) {
+            if (owner[blk] < 0) owner[blk] = static_cast<int16_t>(i);
         }
+    }
+    auto describe = [&](const uint32_t i) -> pair<Kind, int16_t> {
+        if (i == 0) return {SUPER, -1};
+        if (i >= sb.dirStartBlock && i < sb.dirStartBlock + sb.dirBlockCount) return {DIR, -1};
+        if (i >= sb.fatStartBlock && i < sb.fatStartBlock + sb.fatBlockCount) return {FAT_BLOCKS, -1};
+        if (i >= sb.sumStartBlock && i < sb.sumStartBlock + sb.sumBlockCount) return {SUMS, -1};
+        if (i >= sb.tierStartBlock && i < sb.tierStartBlock + sb.tierBlockCount) return {TIERS, -1};
+        if (FAT[i] == FAT_FREE) return {FREE, -1};
+        return owner[i] >= 0 ? make_pair(FILE, owner[i]) : make_pair(UNKNOWN, static_cast<int16_t>(-1));
     };
 
-    uint32_t start = 0;
-    auto [currType, currStatus] = describe_block(0);
+    bool first = true;
+    auto emit = [&](const uint32_t from, const uint32_t to, const Kind kind, const int16_t file) {
+        const string name = file >= 0 ? string(directory[file].name, strnlen(directory[file].name, 32)) : "";
+        if (format == FORMAT_JSON) {
+            cout << (first ? "\n" : ",\n") << "{\"start\":" << from << ",\"end\":" << to << ",\"blocks\":"
+                    << to - from + 1 << ",\"type\":\"" << keys[kind] << "\"";
+            if (file >= 0) cout << ",\"file\":" << jsonString(name);
+            cout << "}";
+        } else if (format == FORMAT_CSV) {
+            cout << from << "," << to << "," << to - from + 1 << "," << keys[kind] << "," << csvField(name) << "\n";
+        } else {
+            const string type = kind == FILE ? "File(" + name + ")" : tableNames[kind];
+            cout << setw(4) << from << "-" << setw(4) << to << "        | "
+                    << setw(13) << type << " | " << (kind == FREE ? "free" : "occupied") << "\n";
+        }
+        first = false;
+    };
 
+    if (format == FORMAT_JSON) {
+        cout << "{\"disk\":" << jsonString(diskPath) << ",\"block_size\":" << BLOCK_SIZE << ",\"total_blocks\":"
+                << sb.totalBlocks << ",\"ranges\":[";
+    } else if (format == FORMAT_CSV) {
+        cout << "start,end,blocks,type,file\n";
+    } else {
+        cout << "Range            | Type           | Status\n";
+        cout << "-----------------------------------------------\n";
+    }
+    uint32_t start = 0;
+    auto [currKind, currFile] = describe(0);
     for (uint32_t i = 1; i < sb.totalBlocks; ++i) {
-        if (auto [type, status] = describe_block(i); type != currType || status != currStatus) {
-            cout << setw(4) << start << "-" << setw(4) << i - 1 << "        | "
-                    << setw(13) << currType << " | " << currStatus << "\n";
+        if (auto [kind, file] = describe(i); kind != currKind || file != currFile) {
+            emit(start, i - 1, currKind, currFile);
             start = i;
-            currType = type;
-            currStatus = status;
+            currKind = kind;
+            currFile = file;
         }
     }
-
     // Final group
-    cout << setw(4) << start << "-" << setw(4) << sb.totalBlocks - 1 << "        | "
-            << setw(13) << currType << " | " << currStatus << "\n";
+    emit(start, sb.totalBlocks - 1, currKind, currFile);
+    if (format == FORMAT_JSON) cout << "\n]}\n";
 }
 
 
+// Fragmentation of the files and of the free space, from one walk of every chain and one scan of the FAT
+// Block numbers are the logical ones, so on striped or mirrored disks a seek is a jump in the block map
+void VirtualFileSystem::showFragmentation(const uint32_t format) const {
+    PROFILE_SCOPE("showFragmentation");
+    struct FileFrag {
+        string name;
+        uint64_t size;
+        uint32_t blocks, fragments;
+    };
+    vector<FileFrag> files;
+    uint64_t usedBlocks = 0, fragments = 0, seeks = 0;
+    int64_t head = -1;  // Last block read, reading every file in directory order
+    for (const auto &entry: directory) {
+        if (entry.name[0] == '\0') continue;
+        FileFrag file{string(entry.name, strnlen(entry.name, sizeof(entry.name))), entry.size, 0, 0};
+        int32_t prev = -1;
+        for (int32_t blk = entry.firstBlock; blk >= 0 && static_cast<uint32_t>(blk) < sb.totalBlocks &&
+                                             static_cast<uint64_t>(file.blocks) * BLOCK_SIZE < entry.size;
+             blk = FAT[blk], ++file.blocks) {
+            if (blk != prev + 1 || prev < 0) ++file.fragments;
+            if (blk != head + 1) ++seeks;
+            prev = head = blk;
+        }
+        usedBlocks += file.blocks;
+        fragments += file.fragments;
+        files.push_back(file);
+    }
+
+    // Free extents, bucketed by powers of two: 1, 2-3, 4-7, ...
+    vector<pair<uint64_t, uint64_t> > freeHist;  // Extents and blocks per bucket
+    uint64_t freeBlocks = 0, freeExtents = 0, largestFree = 0;
+    for (uint32_t i = sb.dataStartBlock; i < sb.totalBlocks;) {
+        if (FAT[i] != FAT_FREE) {
+            ++i;
+            continue;
+        }
+        uint32_t run = 0;
+        while (i < sb.totalBlocks && FAT[i] == FAT_FREE) ++run, ++i;
+        const uint32_t bucket = 31 - countl_zero(run);
+        if (freeHist.size() <= bucket) freeHist.resize(bucket + 1);
+        ++freeHist[bucket].first;
+        freeHist[bucket].second += run;
+        ++freeExtents;
+        freeBlocks += run;
+        largestFree = max<uint64_t>(largestFree, run);
+    }
+    const uint64_t fragmented = count_if(files.begin(), files.end(), [](const FileFrag &f) { return f.fragments > 1; });
+    const double avgRun = fragments ? static_cast<double>(usedBlocks) / fragments : 0;
+    const double avgFree = freeExtents ? static_cast<double>(freeBlocks) / freeExtents : 0;
+
+    if (format == FORMAT_JSON) {
+        cout << "{\"disk\":" << jsonString(diskPath) << ",\"block_size\":" << BLOCK_SIZE << ",\"files\":" << files.size()
+                << ",\"fragmented_files\":" << fragmented << ",\"used_blocks\":" << usedBlocks << ",\"fragments\":"
+                << fragments << ",\"avg_run_blocks\":" << avgRun << ",\"read_seeks\":" << seeks
+                << ",\"free_blocks\":" << freeBlocks << ",\"free_extents\":" << freeExtents
+                << ",\"largest_free_extent\":" << largestFree << ",\"free_histogram\":[";
+        for (size_t b = 0; b < freeHist.size(); ++b) {
+            cout << (b ? "," : "") << "[" << (1ULL << b) << "," << freeHist[b].first << "," << freeHist[b].second << "]";
+        }
+        cout << "],\"per_file\":[";
+        for (size_t i = 0; i < files.size(); ++i) {
+            cout << (i ? ",\n" : "\n") << "{\"name\":" << jsonString(files[i].name) << ",\"size\":" << files[i].size
+                    << ",\"blocks\":" << files[i].blocks << ",\"fragments\":" << files[i].fragments << "}";
+        }
+        cout << (files.empty() ? "" : "\n") << "]}\n";
+        return;
+    }
+
+    cout << left << setw(20) << "Name" << right << setw(10) << "Size" << setw(8) << "Blocks" << setw(11)
+            << "Fragments" << setw(9) << "Avg run" << "\n";
+    cout << string(58, '-') << "\n";
+    cout << fixed << setprecision(1);
+    for (const auto &file: files) {
+        cout << left << setw(20) << file.name << right << setw(10) << file.size << setw(8) << file.blocks
+                << setw(11) << file.fragments << setw(9)
+                << (file.fragments ? static_cast<double>(file.blocks) / file.fragments : 0) << "\n";
+    }
+    if (files.empty()) cout << "(no files)\n";
+    cout << "\nFiles:               " << files.size() << " (" << fragmented << " fragmented)\n"
+            << "Fragments:           " << fragments << ", avg run " << avgRun << " blocks\n"
+            << "Seeks to read all:   " << seeks << " (" << files.size() << " if every file were contiguous)\n"
+            << "Free blocks:         " << freeBlocks << " in " << freeExtents << " extents, avg " << avgFree
+            << ", largest " << largestFree << "\n";
+    if (!freeHist.empty()) {
+        cout << "\nFree extent size     Extents   Blocks\n";
+        for (size_t b = 0; b < freeHist.size(); ++b) {
+            if (freeHist[b].first == 0) continue;
+            const uint64_t low = 1ULL << b, high = (2ULL << b) - 1;
+            const string range = low == high ? to_string(low) : to_string(low) + "-" + to_string(high);
+            cout << left << setw(18) << range << right << setw(10) << freeHist[b].first << setw(9)
+                    << freeHist[b].second << "\n";
+        }
+    }
+}
+
+// Hottest files and block ranges from the .heat file, and how much cache would hold the hot part
+void VirtualFileSystem::showHeat(const uint32_t top) const {
+    PROFILE_SCOPE("showHeat");
+    HeatCounts counts;
+    if (!readHeatFile(diskPath + HEAT_SUFFIX, counts) || counts.total == 0) {
+        cout << "No block accesses sampled for '" << diskPath << "' yet, run commands on it with --heat-sample=<n>.\n";
+        return;
+    }
+    cout << "Block accesses: ~" << counts.total << " (" << counts.total * BLOCK_SIZE / 1024 << " KiB)";
+    if (counts.decays > 0) cout << ", older ones halved " << counts.decays << " times";
+    cout << "\n\n";
+
+    struct HotFile {
+        string name;
+        uint64_t size, accesses;
+    };
+    vector<HotFile> files;
+    for (const auto &entry: directory) {
+        if (entry.name[0] == '\0') continue;
+        const string name(entry.name, strnlen(entry.name, sizeof(entry.name)));
+        files.push_back({name, entry.size, counts.estimate(heatFileKey(name))});
+    }
+    sort(files.begin(), files.end(), [](const HotFile &a, const HotFile &b) { return a.accesses > b.accesses; });
+    if (files.size() > top) files.resize(top);
+    cout << left << setw(20) << "Name" << right << setw(10) << "Size" << setw(12) << "Accesses" << setw(8) << "Share"
+            << setw(12) << "Per block" << "\n";
+    cout << string(62, '-') << "\n";
+    cout << fixed << setprecision(1);
+    for (const auto &file: files) {
+        const uint64_t blocks = max<uint64_t>(1, (file.size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        cout << left << setw(20) << file.name << right << setw(10) << file.size << setw(12) << file.accesses
+                << setw(7) << 100.0 * file.accesses / counts.total << "%" << setw(12)
+                << static_cast<double>(file.accesses) / blocks << "\n";
+    }
+    if (files.empty()) cout << "(no files)\n";
+
+    // Heatmap of the data area, at most HEAT_ROWS rows of whole chunks
+    constexpr uint32_t HEAT_ROWS = 32, BAR_WIDTH = 40;
+    const uint32_t firstChunk = sb.dataStartBlock / HEAT_CHUNK_BLOCKS;
+    const uint32_t chunks = (sb.totalBlocks + HEAT_CHUNK_BLOCKS - 1) / HEAT_CHUNK_BLOCKS - firstChunk;
+    const uint32_t perRow = (chunks + HEAT_ROWS - 1) / HEAT_ROWS;
+    vector<uint64_t> chunkHeat(chunks), rows((chunks + perRow - 1) / perRow);
+    for (uint32_t c = 0; c < chunks; ++c) {
+        chunkHeat[c] = counts.estimate(heatChunkKey(firstChunk + c));
+        rows[c / perRow] += chunkHeat[c];
+    }
+    const uint64_t hottest = max<uint64_t>(1, *max_element(rows.begin(), rows.end()));
+    cout << "\nBlocks             Accesses\n";
+    for (size_t r = 0; r < rows.size(); ++r) {
+        const uint64_t from = max<uint64_t>(sb.dataStartBlock, (firstChunk + r * perRow) * HEAT_CHUNK_BLOCKS);
+        const uint64_t to = min<uint64_t>(sb.totalBlocks, (firstChunk + (r + 1) * perRow) * HEAT_CHUNK_BLOCKS) - 1;
+        cout << right << setw(7) << from << "-" << left << setw(7) << to << right << setw(12) << rows[r] << "  "
+                << string((rows[r] * BAR_WIDTH + hottest - 1) / hottest, '#') << "\n";
+    }
+
+    // Fewest chunks that take a given share of the accesses: the cache that would serve them
+    sort(chunkHeat.begin(), chunkHeat.end(), greater<>());
+    uint64_t sum = 0;
+    for (const uint64_t heat: chunkHeat) sum += heat;
+    cout << "\nCache for";
+    for (const double share: {0.5, 0.9, 0.99}) {
+        uint64_t covered = 0;
+        size_t needed = 0;
+        while (needed < chunkHeat.size() && covered < share * sum) covered += chunkHeat[needed++];
+        cout << (share == 0.5 ? " " : ", ") << setprecision(0) << share * 100 << "% of accesses: "
+                << needed * HEAT_CHUNK_BLOCKS * BLOCK_SIZE / 1024 << " KiB";
+    }
+    cout << "\n";
+}
+
 // Delete the virtual disk file
 bool VirtualFileSystem::removeDisk() {
+    // The member files of a multi-file image go with it, an overlay's base is shared and stays
+    if (!disk.is_open()) {
+        disk.open(diskPath, ios::in | ios::binary);
+        if (!disk.is_open() || !readSuperblock()) memset(&sb, 0, sizeof(sb));
+    }
+    vector<string> members;
+    if (sb.imageType != IMAGE_OVERLAY) {
+        for (uint32_t m = 0; m < min(sb.memberCount, MAX_MEMBERS); ++m) {
+            members.push_back(resolveBackingPath(sb.members[m], MEMBER_PATH_LEN));
+        }
+    }
     if (disk.is_open()) {
         disk.close();
     }
@@ -439,6 +1504,14 @@ bool VirtualFileSystem::removeDisk() {
         cerr << "Error: Could not delete disk '" << diskPath << "'\n";
         return false;
     }
+    for (const auto &member: members) {
+        if (std::remove(member.c_str()) != 0) {
+            cerr << "Error: Could not delete member file '" << member << "'\n";
+        }
+    }
+    keepStats = false;
+    std::remove((diskPath + STATS_SUFFIX).c_str());
+    std::remove((diskPath + HEAT_SUFFIX).c_str());
     cout << "Deleted virtual disk '" << diskPath << "'.\n";
     return true;
 }
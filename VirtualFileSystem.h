@@ -8,11 +8,29 @@
 #include    <cstdint>
 #include    <fstream>
 #include    <vector>
+#include    <memory>
+#include    "Metrics.h"
+#include    "Heat.h"
+#include    "IoStats.h"
 
 static constexpr uint32_t MAX_FILES = 64;                       // Limit of files in the virtual file system
 static constexpr uint32_t BLOCK_SIZE = 512;                     // Block size in bytes
 static constexpr uint32_t DEFAULT_DISK_SIZE = 10 * 1024 * 1024; // File system default size in bytes (10 MB)
 static constexpr char FS_NAME[8] = "TTvfs01";                   // File system name
+static constexpr uint32_t BASE_PATH_LEN = 64;                   // Max length of a backing image path (incl. null)
+static constexpr uint32_t MAX_MEMBERS = 6;                      // Max backing files of a multi-file image
+static constexpr uint32_t MEMBER_PATH_LEN = 48;                 // Max length of a member file path (incl. null)
+static constexpr uint32_t IO_BATCH_BLOCKS = 256;                // Blocks moved per batch by dput/dget (128 KB)
+
+// Image types, stored in the superblock
+// Older images have zeros past dataStartBlock, so they read back as plain
+static constexpr uint32_t IMAGE_PLAIN = 0;      // Everything lives in the one file
+static constexpr uint32_t IMAGE_OVERLAY = 1;    // Only modified blocks live here, the rest come from a base image
+static constexpr uint32_t IMAGE_STRIPED = 2;    // Metadata here, data blocks striped across member files (RAID-0)
+static constexpr uint32_t IMAGE_MIRRORED = 3;   // Metadata here, every data block on every member file (RAID-1)
+static constexpr uint32_t IMAGE_PARITY = 4;     // Metadata here, data striped with 1 or 2 parity units per row (RAID-5/6)
+static constexpr uint32_t IMAGE_SPLIT = 5;      // Metadata here, all data blocks in one separate data file
+static constexpr uint32_t IMAGE_TIERED = 6;     // Metadata here, hot data blocks in a small fast file, the rest in a slow one
 
 // Superblock stored in block 0
 // This contains metadata about the file system
@@ -29,8 +47,24 @@ struct SuperBlock {
     uint32_t fatStartBlock;     // Block index where the FAT starts
     uint32_t fatBlockCount;     // Number of blocks used by the FAT
     uint32_t dataStartBlock;    // Block index where data starts
+    uint32_t imageType;         // One of IMAGE_*
+    uint32_t mapStartBlock;     // Overlay only: block index of the block map (past the last data block)
+    uint32_t mapBlockCount;     // Overlay only: number of blocks used by the block map
+    char basePath[BASE_PATH_LEN]; // Overlay only: base image, relative paths are relative to the overlay
+    uint32_t memberCount;       // Multi-file images: number of member files holding the data blocks
+    uint32_t stripeBlocks;      // Striped, parity: number of consecutive data blocks placed on one member
+                                // Mirrored: number of consecutive data blocks preferably read from one member
+    char members[MAX_MEMBERS][MEMBER_PATH_LEN]; // Multi-file images: member files, relative like basePath
+    uint32_t sumStartBlock;     // Mirrored: block index of the per-block CRC32 table
+    uint32_t sumBlockCount;     // Mirrored: number of blocks used by the CRC32 table
+    uint32_t parityCount;       // Parity: parity units per row, 1 (P, RAID-5) or 2 (P+Q, RAID-6)
+    uint32_t staleMembers;      // Mirrored, parity: bit per member that missed writes and needs a rebuild
+    uint32_t tierStartBlock;    // Tiered: block index of the tier table (TierEntry per block)
+    uint32_t tierBlockCount;    // Tiered: number of blocks used by the tier table
+    uint32_t fastBlocks;        // Tiered: capacity of the fast tier file in blocks
 };
 #pragma pack(pop)
+static_assert(sizeof(SuperBlock) <= BLOCK_SIZE, "Superblock must fit in block 0");
 
 // Directory entry structure
 #pragma pack(push, 1)
@@ -43,6 +77,23 @@ struct DirEntry {
 };
 #pragma pack(pop)
 
+// How createDisk lays out a new disk, the defaults give a plain single-file disk
+struct DiskLayout {
+    uint32_t imageType = IMAGE_PLAIN;   // One of IMAGE_* (overlays have their own createOverlay)
+    std::vector<std::string> members;   // Member files for multi-file images
+    uint32_t stripeBlocks = 16;         // Striped, parity: blocks per stripe unit, mirrored: blocks per read unit
+    uint32_t parityCount = 1;           // Parity: 1 (RAID-5) or 2 (RAID-6) of the members hold parity per row
+    uint32_t fastBlocks = 0;            // Tiered: size of the fast tier in blocks
+};
+
+// Tier table entry, one per block of a tiered disk
+#pragma pack(push, 1)
+struct TierEntry {
+    uint32_t fastSlot;      // Block index in the fast tier file plus one, 0 if the block lives in the slow tier
+    uint32_t heat;          // Accesses since the last migration pass, halved by every pass
+};
+#pragma pack(pop)
+
 class VirtualFileSystem {
 public:
     explicit VirtualFileSystem(std::string diskPath); // Not sure what explicit does, but CLANG recommends
@@ -50,25 +101,79 @@ public:
 
     // Perform formatting and create a new virtual disk
     // Default size is assumed to be 10MB if not given
-    bool createDisk(uint32_t diskSize = DEFAULT_DISK_SIZE);
+    bool createDisk(uint32_t diskSize = DEFAULT_DISK_SIZE, const DiskLayout &layout = {});
+
+    // Create an overlay on top of an existing (read-only) base image
+    // The overlay starts out with the base's directory and FAT, and stores
+    // only the data blocks written after that
+    bool createOverlay(const std::string &basePath);
+
+    // Record every file operation of every disk in this process to a trace file (Trace.h)
+    static void traceTo(const std::string &path);
 
     // Load VD
-    bool loadDisk();
+    // Read-only access is used for overlay bases, which are never written to
+    bool loadDisk(bool readOnly = false);
+
+    // True if otherPath is the overlay base of this disk, or a base further down
+    // Reads superblocks only and takes no lock, so it can be asked before loading either disk
+    bool isBackedBy(const std::string &otherPath) const;
+
+    // Merge the blocks and metadata of an overlay down into its base image
+    bool commitOverlay();
+
+    // Rewrite missing or out-of-date member files of a mirrored or parity disk from the others
+    bool rebuildMembers();
+
+    // One migration pass of a tiered disk: promote the hottest blocks to the fast tier and demote
+    // the coldest, copying at most budgetBlocks blocks
+    bool migrateTiers(uint32_t budgetBlocks);
+
+    // Grow a loaded disk to newSize bytes, moving the FAT to the new tail if it no longer fits
+    bool growDisk(uint32_t newSize);
+
+    // Shrink a loaded disk to newSize bytes (0 = as small as the files allow)
+    // Blocks past the new end are moved into free blocks lower in the disk first
+    bool shrinkDisk(uint32_t newSize = 0);
 
     // File operations on VD
     bool copyFromHost(const std::string &hostFile);                             // HOST -> VD
     bool copyToHost(const std::string &fileName, const std::string &destPath);  // VD -> HOST
     bool deleteFile(const std::string &fileName);                               // Remove file from VD
-    void listFiles() const;                                                     //Basically "ls"
-    void showMap() const;                                                       //Show block occupancy map
+    bool copyToDisk(const std::string &fileName, VirtualFileSystem &dest,
+                    const std::string &newName);                                // VD -> other VD
+    bool renameFile(const std::string &fileName, const std::string &newName);   // Rename file on VD
+    bool statFile(const std::string &fileName, DirEntry &info) const;           // Directory entry of a file
+    void listFiles(uint32_t format = 0) const;                                  //Basically "ls", format is a FORMAT_*
+    std::vector<std::string> fileNames() const;                                 //Names of all files on VD
+    void showMap(uint32_t format = 0) const;                                    //Show block occupancy map
+    void showFragmentation(uint32_t format = 0) const;                          //Fragment and free extent report
+    void showHeat(uint32_t top) const;                                          //Hottest files and block ranges
+    MetricsSnapshot metrics() const;                                            //Counters of this process so far
     bool removeDisk();                                                          //Remove VD file
 
 private:
+    friend struct VfsBenchAccess;       // bench/BenchUtil.h, lets vfs_bench time the private helpers
+
     std::string diskPath;               // Path to the disk file
     std::fstream disk;                  // File stream for disk
+    IoCursor diskIo;                    // --io-stats position in the disk file
     SuperBlock sb{};                      // METAINFO
     std::vector<DirEntry> directory;    // Dir table
     std::vector<int32_t> FAT;           // File Allocation Table
+    std::vector<uint8_t> blockMap;      // Overlay only: one bit per block, set if the block lives in the overlay
+    std::unique_ptr<VirtualFileSystem> base; // Overlay only: the image unmodified blocks are read from
+    std::vector<std::fstream> memberFiles;   // Multi-file images: open member files, same order as sb.members
+    std::vector<IoCursor> memberIo;          // --io-stats positions in memberFiles
+    std::vector<char> memberMissing;         // Multi-file images: members that could not be opened
+    std::vector<uint32_t> checksums;         // Mirrored: CRC32 of every data block
+    std::vector<TierEntry> tiers;            // Tiered: where every block lives and how hot it is
+    bool readOnly = false;                   // Loaded read-only, nothing is written back
+    inline static std::string tracePath;     // Trace file set by traceTo(), empty when not tracing
+    mutable Metrics stats;                   // Added to <diskPath>.stats by the destructor
+    HeatSketch heat;                         // Sampled block accesses, added to <diskPath>.heat by the destructor
+    bool keepStats = true;                   // Cleared by removeDisk, so the sidecars aren't recreated
+    int lockFd = -1;                         // Holds the disk lock from loadDisk until destruction
 
     // Internal helper functions
     bool readSuperblock();
@@ -77,6 +182,52 @@ private:
     bool writeDirectory();
     bool readFAT();
     bool writeFAT();
+    bool readBlockMap();
+    bool writeBlockMap();
+    bool readChecksums();
+    bool writeChecksums();
+    bool readTierTable();
+    bool writeTierTable();
+    bool lockDisk();
+    bool openBase(bool readOnly);
+    std::string resolveBackingPath(const char *name, size_t maxLen) const;
+    bool syncDisk();
+
+    // Data block I/O, this is where overlays redirect reads to the base image
+    bool readDataBlock(uint32_t blk, char *buffer);
+    bool writeDataBlock(uint32_t blk, const char *buffer);
+
+    // Multi-file images (DataLayout.cpp)
+    uint32_t memberBlockCount(uint32_t member) const;
+    bool createMembers();
+    bool openMembers(bool readOnly);
+    void markStale(const std::vector<char> &lost);
+    std::pair<uint32_t, uint64_t> locateBlock(uint32_t blk) const; // Member and block index within it
+    // File and byte offset holding a data block, false if it has no single fixed place (overlay, mirror, parity, tiers)
+    bool blockLocation(uint32_t blk, std::string &path, uint64_t &offset) const;
+
+    // Batched data block I/O, 'buffer' holds blocks.size() blocks back to back
+    // Blocks on different member files are transferred in parallel
+    bool readDataBlocks(const std::vector<int32_t> &blocks, char *buffer);
+    bool writeDataBlocks(const std::vector<int32_t> &blocks, const char *buffer);
+    bool transferBlocks(const std::vector<int32_t> &blocks, char *buffer, bool write);
+    std::vector<char> transferMembers(std::vector<std::vector<std::pair<uint64_t, size_t> > > &runs,
+                                      char *buffer, bool write);
+    static bool transferRun(std::fstream &file, IoCursor &cursor, std::vector<std::pair<uint64_t, size_t> > &run,
+                            char *buffer, bool write);
+    bool readMirrored(const std::vector<int32_t> &blocks, char *buffer);
+    bool writeMirrored(const std::vector<int32_t> &blocks, const char *buffer);
+
+    // Parity disks (ParityLayout.cpp)
+    uint32_t parityMember(uint32_t row, uint32_t column) const;
+    bool readParityRows(const std::vector<uint32_t> &rows, char *staging, bool dataOnly);
+    bool readParity(const std::vector<int32_t> &blocks, char *buffer);
+    bool writeParity(const std::vector<int32_t> &blocks, const char *buffer);
+
+    // Tiered disks (TieredLayout.cpp)
+    bool transferTiered(const std::vector<int32_t> &blocks, char *buffer, bool write);
+
+    void traceOp(uint8_t op, const std::string &name, uint64_t offset, uint64_t length) const;
 
     bool findFreeBlocks(uint32_t count, std::vector<int32_t> &blocks) const;
     int findDirectoryEntry(const std::string &name) const;
@@ -0,0 +1,396 @@
+// Workload.cpp
+// Job file parsing and the job runner behind dbench
+#include "Workload.h"
+#include "VirtualFileSystem.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Profile.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <array>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unistd.h>    // for getpid()
+
+using namespace std;
+
+// Operations a job can mix
+enum WorkOp : uint32_t {
+    WORK_PUT,
+    WORK_GET,
+    WORK_DELETE,
+    WORK_STAT,
+    WORK_OPS
+};
+
+static const char *workOpNames[WORK_OPS] = {"put", "get", "delete", "stat"};
+
+struct WorkloadJob {
+    string name;
+    uint32_t threads = 1;
+    uint32_t files = 8;                     // Per thread
+    uint64_t minSize = 4096, maxSize = 4096;
+    bool expSizes = false;                  // Exponential instead of uniform between minSize and maxSize
+    array<uint32_t, WORK_OPS> mix{50, 50, 0, 0};
+    bool sequential = false;
+    double rate = 0;                        // ops/s over all threads, 0 = unlimited
+    double runtime = 0;                     // Seconds, 0 = until ops are done
+    uint64_t ops = 0;                       // Over all threads, 0 = until runtime is up
+};
+
+static string trim(const string &text) {
+    const size_t first = text.find_first_not_of(" \t\r");
+    if (first == string::npos) return "";
+    return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+// Byte count with an optional k, m or g (powers of 1024)
+static bool parseBytes(const string &text, uint64_t &bytes) {
+    size_t end = 0;
+    try {
+        bytes = stoull(text, &end);
+    } catch (const exception &) {
+        return false;
+    }
+    const string unit = text.substr(end);
+    if (unit == "k" || unit == "K") bytes <<= 10;
+    else if (unit == "m" || unit == "M") bytes <<= 20;
+    else if (unit == "g" || unit == "G") bytes <<= 30;
+    else if (!unit.empty()) return false;
+    return true;
+}
+
+// One key of a job section, false if the key or its value is no good
+static bool setJobKey(WorkloadJob &job, const string &key, const string &value) {
+    try {
+        if (key == "threads") {
+            job.threads = static_cast<uint32_t>(stoul(value));
+            return job.threads > 0;
+        }
+        if (key == "files") {
+            job.files = static_cast<uint32_t>(stoul(value));
+            return job.files > 0;
+        }
+        if (key == "size") {
+            const size_t dash = value.find('-');
+            if (!parseBytes(value.substr(0, dash), job.minSize)) return false;
+            job.maxSize = job.minSize;
+            if (dash != string::npos && !parseBytes(value.substr(dash + 1), job.maxSize)) return false;
+            return job.minSize > 0 && job.minSize <= job.maxSize;
+        }
+        if (key == "size_dist") {
+            job.expSizes = value == "exp";
+            return value == "exp" || value == "uniform";
+        }
+        if (key == "mix") {
+            job.mix.fill(0);
+            stringstream items(value);
+            string item;
+            while (getline(items, item, ',')) {
+                const size_t colon = item.find(':');
+                if (colon == string::npos) return false;
+                const string op = trim(item.substr(0, colon));
+                uint32_t i = 0;
+                while (i < WORK_OPS && op != workOpNames[i]) ++i;
+                if (i == WORK_OPS) return false;
+                job.mix[i] = static_cast<uint32_t>(stoul(item.substr(colon + 1)));
+            }
+            return job.mix[0] + job.mix[1] + job.mix[2] + job.mix[3] > 0;
+        }
+        if (key == "rwmixread") {
+            const auto reads = static_cast<uint32_t>(stoul(value));
+            job.mix = {100 - min(reads, 100u), min(reads, 100u), 0, 0};
+            return reads <= 100;
+        }
+        if (key == "access") {
+            job.sequential = value == "sequential";
+            return value == "sequential" || value == "random";
+        }
+        if (key == "rate") {
+            job.rate = stod(value);
+            return job.rate >= 0;
+        }
+        if (key == "runtime") {
+            job.runtime = stod(value);
+            return job.runtime >= 0;
+        }
+        if (key == "ops") {
+            job.ops = stoull(value);
+            return true;
+        }
+    } catch (const exception &) {
+    }
+    return false;
+}
+
+static bool parseJobFile(const string &path, string &disk, uint64_t &diskSize, vector<WorkloadJob> &jobs) {
+    ifstream in(path);
+    if (!in) {
+        cerr << "Error: Cannot open job file '" << path << "'\n";
+        return false;
+    }
+    WorkloadJob defaults;
+    WorkloadJob *current = &defaults;
+    bool global = true;
+    string line;
+    for (uint32_t number = 1; getline(in, line); ++number) {
+        line = trim(line.substr(0, line.find_first_of(";#")));
+        if (line.empty()) continue;
+        if (line.front() == '[' && line.back() == ']') {
+            const string section = trim(line.substr(1, line.size() - 2));
+            global = section == "global";
+            if (global) {
+                current = &defaults;
+            } else {
+                jobs.push_back(defaults);
+                jobs.back().name = section;
+                current = &jobs.back();
+            }
+            continue;
+        }
+        const size_t equals = line.find('=');
+        const string key = trim(line.substr(0, equals)), value = equals == string::npos ? "" : trim(line.substr(equals + 1));
+        bool ok;
+        if (key == "disk") {
+            disk = value;
+            ok = global && !value.empty();
+        } else if (key == "disk_size") {
+            ok = global && parseBytes(value, diskSize);
+        } else {
+            ok = setJobKey(*current, key, value);
+        }
+        if (!ok) {
+            cerr << "Error: " << path << ":" << number << ": bad setting '" << line << "'\n";
+            return false;
+        }
+    }
+    if (disk.empty()) {
+        cerr << "Error: Job file '" << path << "' names no disk (disk=<file> under [global])\n";
+        return false;
+    }
+    if (jobs.empty()) {
+        cerr << "Error: Job file '" << path << "' has no jobs\n";
+        return false;
+    }
+    for (auto &job: jobs) {
+        if (static_cast<uint64_t>(job.threads) * job.files > MAX_FILES) {
+            cerr << "Error: Job '" << job.name << "' needs " << job.threads * job.files << " files, a disk holds "
+                    << MAX_FILES << "\n";
+            return false;
+        }
+        if (job.ops == 0 && job.runtime == 0) job.ops = 1000;
+    }
+    return true;
+}
+
+// One thread of a job: its files, and what it measured
+struct ThreadState {
+    mt19937_64 rng;
+    vector<string> names;
+    vector<uint64_t> sizes;     // 0 = no file in the slot
+    array<OpMetrics, WORK_OPS> ops;
+    uint64_t waitNs = 0;        // Spent waiting for the disk
+    uint64_t busyNs = 0;        // Spent in operations, the waits included
+};
+
+static void addSample(OpMetrics &op, const uint64_t ns, const uint64_t bytes, const bool ok) {
+    ++op.count;
+    op.errors += !ok;
+    op.bytes += ok ? bytes : 0;
+    op.totalNs += ns;
+    op.maxNs = max(op.maxNs, ns);
+    ++op.buckets[histBucket(ns)];
+}
+
+static uint64_t drawSize(const WorkloadJob &job, mt19937_64 &rng) {
+    if (job.minSize == job.maxSize) return job.minSize;
+    if (job.expSizes) {
+        exponential_distribution<double> tail(4.0 / static_cast<double>(job.maxSize - job.minSize));
+        return min(job.maxSize, job.minSize + static_cast<uint64_t>(tail(rng)));
+    }
+    return uniform_int_distribution<uint64_t>(job.minSize, job.maxSize)(rng);
+}
+
+// Host file to put from, sparse, dput only needs its name and size
+static string hostFile(const filesystem::path &scratch, const string &name, const uint64_t size) {
+    const filesystem::path path = scratch / name;
+    ofstream(path, ios::binary | ios::trunc).close();
+    filesystem::resize_file(path, size);
+    return path.string();
+}
+
+static void runThread(VirtualFileSystem &vfs, mutex &diskLock, const WorkloadJob &job, const uint32_t thread,
+                      const filesystem::path &scratch, const chrono::steady_clock::time_point start,
+                      ThreadState &state) {
+    const uint32_t weights = job.mix[0] + job.mix[1] + job.mix[2] + job.mix[3];
+    const uint64_t opsForThread = job.ops == 0 ? UINT64_MAX : (job.ops + job.threads - 1 - thread) / job.threads;
+    const auto end = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(
+                         job.runtime > 0 ? job.runtime : 1e9));
+    const double interval = job.rate > 0 ? job.threads / job.rate : 0;   // Seconds between this thread's ops
+    uint32_t cursor = thread;   // Sequential access starts each thread somewhere else
+    for (uint64_t n = 0; n < opsForThread; ++n) {
+        // When the op is asked for: on schedule when paced, unless this thread is running behind, then
+        // the time it's late counts too
+        auto due = chrono::steady_clock::now();
+        if (interval > 0) {
+            if (const auto planned = start + chrono::duration_cast<chrono::steady_clock::duration>(
+                                         chrono::duration<double>(n * interval)); planned > due) {
+                this_thread::sleep_until(planned);
+                due = chrono::steady_clock::now();
+            } else {
+                due = planned;
+            }
+        }
+        if (due >= end) break;
+
+        uint32_t pick = uniform_int_distribution<uint32_t>(0, weights - 1)(state.rng), op = 0;
+        while (pick >= job.mix[op]) pick -= job.mix[op++];
+        // Puts go anywhere, overwriting, the rest need a file: without any the op turns into a put
+        if (op != WORK_PUT && count(state.sizes.begin(), state.sizes.end(), 0) == static_cast<long>(job.files)) {
+            op = WORK_PUT;
+        }
+        auto eligible = [&](const uint32_t slot) { return op == WORK_PUT || state.sizes[slot] != 0; };
+        uint32_t slot;
+        if (job.sequential) {
+            do slot = cursor++ % job.files; while (!eligible(slot));
+        } else {
+            do slot = uniform_int_distribution<uint32_t>(0, job.files - 1)(state.rng); while (!eligible(slot));
+        }
+
+        string path;
+        uint64_t size = state.sizes[slot];
+        if (op == WORK_PUT) {
+            size = drawSize(job, state.rng);
+            path = hostFile(scratch, state.names[slot], size);
+        }
+        bool ok = false;
+        const auto asked = interval > 0 ? due : chrono::steady_clock::now();  // Unpaced, after the host file
+        {
+            unique_lock guard(diskLock, defer_lock);
+            {
+                PROFILE_SPAN("disk lock", "wait");
+                guard.lock();
+            }
+            state.waitNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - asked).count();
+            DirEntry info{};
+            switch (op) {
+                case WORK_PUT:
+                    ok = (state.sizes[slot] == 0 || vfs.deleteFile(state.names[slot])) && vfs.copyFromHost(path);
+                    state.sizes[slot] = ok ? size : 0;
+                    break;
+                case WORK_GET: ok = vfs.copyToHost(state.names[slot], "/dev/null");
+                    break;
+                case WORK_DELETE:
+                    ok = vfs.deleteFile(state.names[slot]);
+                    state.sizes[slot] = 0;
+                    break;
+                default: ok = vfs.statFile(state.names[slot], info);
+                    break;
+            }
+        }
+        const auto ns = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - asked).count());
+        state.busyNs += ns;
+        addSample(state.ops[op], ns, op == WORK_PUT || op == WORK_GET ? size : 0, ok);
+        if (!path.empty()) filesystem::remove(path);
+    }
+}
+
+static void printJob(const WorkloadJob &job, const array<OpMetrics, WORK_OPS> &ops, const double elapsed,
+                     const uint64_t waitNs, const uint64_t busyNs) {
+    uint64_t total = 0, bytes = 0;
+    for (const auto &op: ops) total += op.count, bytes += op.bytes;
+    cout << "Job '" << job.name << "': " << job.threads << (job.threads == 1 ? " thread, " : " threads, ") << total
+            << " ops in " << fixed << setprecision(3) << elapsed << " s, " << setprecision(1) << total / elapsed
+            << " ops/s";
+    if (job.rate > 0) cout << " (target " << job.rate << ")";
+    cout << ", " << bytes / 1e6 / elapsed << " MB/s, " << (busyNs ? 100.0 * waitNs / busyNs : 0)
+            << "% of the time waiting for the disk\n";
+    cout << left << setw(8) << "Op" << right << setw(10) << "Count" << setw(8) << "Errors" << setw(10) << "ops/s"
+            << setw(10) << "MB/s" << setw(10) << "Mean" << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99"
+            << setw(10) << "p99.9" << setw(10) << "Max" << "\n";
+    cout << string(106, '-') << "\n";
+    for (uint32_t i = 0; i < WORK_OPS; ++i) {
+        const OpMetrics &op = ops[i];
+        if (op.count == 0) continue;
+        cout << left << setw(8) << workOpNames[i] << right << setw(10) << op.count << setw(8) << op.errors
+                << setw(10) << op.count / elapsed << setw(10) << op.bytes / 1e6 / elapsed
+                << setw(10) << op.totalNs / 1e3 / op.count << setw(10) << op.percentile(0.5) / 1e3
+                << setw(10) << op.percentile(0.9) / 1e3 << setw(10) << op.percentile(0.99) / 1e3
+                << setw(10) << op.percentile(0.999) / 1e3 << setw(10) << op.maxNs / 1e3 << "\n";
+    }
+    cout << "(latencies in us)\n\n";
+}
+
+bool runWorkload(const std::string &jobPath) {
+    string diskPath;
+    uint64_t diskSize = DEFAULT_DISK_SIZE;
+    vector<WorkloadJob> jobs;
+    if (!parseJobFile(jobPath, diskPath, diskSize, jobs)) return false;
+    if (diskSize < 4096 || diskSize > 100 * 1024 * 1024) {
+        cerr << "Error: Disk size must be between 4096 bytes and 100 MB." << endl;
+        return false;
+    }
+
+    VirtualFileSystem vfs(diskPath);
+    if (!filesystem::exists(diskPath) && !vfs.createDisk(static_cast<uint32_t>(diskSize))) return false;
+    if (!vfs.loadDisk()) return false;
+
+    const filesystem::path scratch = filesystem::temp_directory_path() / ("ttvfs-dbench-" + to_string(getpid()));
+    filesystem::create_directories(scratch);
+    mutex diskLock;
+    for (uint32_t j = 0; j < jobs.size(); ++j) {
+        const WorkloadJob &job = jobs[j];
+        vector<ThreadState> states(job.threads);
+        double elapsed;
+        {
+            PROFILE_SCOPE("dbench job");
+            Silence quietOut(cout), quietErr(cerr);
+            // Every file starts out on the disk, so gets have something to read, before the clock starts
+            for (uint32_t t = 0; t < job.threads; ++t) {
+                ThreadState &state = states[t];
+                state.rng.seed(hash<string>()(job.name) + t);
+                for (uint32_t i = 0; i < job.files; ++i) {
+                    state.names.push_back("j" + to_string(j) + "t" + to_string(t) + "f" + to_string(i));
+                    const uint64_t size = drawSize(job, state.rng);
+                    state.sizes.push_back(vfs.copyFromHost(hostFile(scratch, state.names[i], size)) ? size : 0);
+                    filesystem::remove(scratch / state.names[i]);
+                }
+            }
+
+            vector<thread> threads;
+            const auto start = chrono::steady_clock::now();
+            for (uint32_t t = 0; t < job.threads; ++t) {
+                threads.emplace_back(runThread, ref(vfs), ref(diskLock), cref(job), t, cref(scratch), start,
+                                     ref(states[t]));
+            }
+            for (auto &worker: threads) worker.join();
+            elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            // Leave the disk as it was
+            for (const auto &state: states) {
+                for (uint32_t i = 0; i < job.files; ++i) {
+                    if (state.sizes[i] != 0) vfs.deleteFile(state.names[i]);
+                }
+            }
+        }
+
+        array<OpMetrics, WORK_OPS> ops;
+        uint64_t waitNs = 0, busyNs = 0;
+        for (const auto &state: states) {
+            for (uint32_t i = 0; i < WORK_OPS; ++i) ops[i].merge(state.ops[i]);
+            waitNs += state.waitNs;
+            busyNs += state.busyNs;
+        }
+        printJob(job, ops, elapsed, waitNs, busyNs);
+    }
+    filesystem::remove_all(scratch);
+    return true;
+}
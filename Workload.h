@@ -0,0 +1,31 @@
+//
+// Synthetic workloads for "vfs dbench": jobs described in an INI-style job file (like fio's) are run
+// one after another against a disk, and each gets its throughput and latency percentiles per operation
+//
+// [global]                     ; disk settings, and defaults for every job below
+// disk=bench.vd                ; created with disk_size if it doesn't exist
+// disk_size=50m
+//
+// [small-files]                ; one section per job, the name is what the report shows
+// threads=4                    ; clients working at the same time
+// files=8                      ; files per thread, threads * files at most MAX_FILES
+// size=4k-64k                  ; file size, or a range to draw from
+// size_dist=uniform            ; uniform, or exp for mostly small files with a long tail
+// mix=put:20,get:70,stat:10    ; weights of put, get, delete and stat (or rwmixread=<get %>)
+// access=random                ; or sequential, the order files are picked in
+// rate=500                     ; ops/s over all threads, 0 or left out for as fast as possible
+// runtime=5                    ; seconds, and/or
+// ops=2000                     ; operations over all threads (1000 when neither is given)
+//
+// The disk is not thread-safe, so the threads take turns on it: latencies include the wait
+// With a rate, an operation that runs late is timed from when it was due, not from when it got to run
+//
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+#include    <string>
+
+// Run every job of the job file, print a report per job
+bool runWorkload(const std::string &jobPath);
+
+#endif //WORKLOAD_H
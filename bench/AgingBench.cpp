@@ -0,0 +1,151 @@
+// AgingBench.cpp
+// Ages a disk with create/delete churn until it sits at a target utilization, and after every
+// epoch of churn measures what aging hurts: cold read throughput, fragments per file and how long
+// allocating a new file takes. Epoch 0 is the disk right after the first fill, before any deletes
+#include "BenchUtil.h"
+#include <filesystem>
+
+using namespace std;
+
+static constexpr uint32_t AGING_TARGET_PCT = 85;    // Utilization the churn keeps the disk at
+static constexpr uint32_t AGING_POOL_FILES = 192;   // Host files to draw from, each name is on the disk at most once
+
+// Number of contiguous runs the file's chain is made of
+static uint32_t chainFragments(VirtualFileSystem &vfs, const DirEntry &entry) {
+    const vector<int32_t> &fat = VfsBenchAccess::fat(vfs);
+    uint32_t fragments = 0;
+    uint64_t blocks = 0;
+    for (int32_t blk = entry.firstBlock, prev = -2; blk >= 0 && blocks * BLOCK_SIZE < entry.size; blk = fat[blk]) {
+        if (blk != prev + 1) ++fragments;
+        prev = blk;
+        ++blocks;
+    }
+    return fragments;
+}
+
+void runAgingSuite(const BenchOptions &options, const std::string &dir, const bool quick,
+                   std::vector<BenchResult> &results) {
+    const uint32_t diskBytes = quick ? 4 << 20 : 64 << 20;
+    const uint32_t epochs = quick ? 3 : 10, opsPerEpoch = quick ? 50 : 300;
+    const filesystem::path root = filesystem::path(dir) / ("vfs_bench-" + to_string(getpid()));
+    const filesystem::path pool = root / "pool";
+    const string diskPath = (root / "aging.vd").string(), readBack = (root / "read.bin").string();
+    filesystem::remove_all(root);
+    filesystem::create_directories(pool);
+
+    // Log-normal sizes scaled so about 40 files reach the target (the directory holds only 64),
+    // capped so one file never takes more than 1/8 of the disk
+    mt19937_64 rng(11);
+    vector<string> poolFiles;
+    vector<uint64_t> poolBlocks;
+    const double meanSize = diskBytes * (AGING_TARGET_PCT / 100.0) / 40, sigma = 1.0;
+    for (uint32_t i = 0; i < AGING_POOL_FILES; ++i) {
+        const double size = lognormal_distribution<double>(log(meanSize) - sigma * sigma / 2, sigma)(rng);
+        const uint64_t bytes = clamp(static_cast<uint64_t>(size), uint64_t{1}, uint64_t{diskBytes / 8});
+        poolFiles.push_back((pool / ("aged-" + to_string(i) + ".bin")).string());
+        poolBlocks.push_back((bytes + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        if (!writeHostFile(poolFiles.back(), bytes, rng)) {
+            cerr << "Error: Cannot create benchmark file in '" << pool.string() << "'\n";
+            return;
+        }
+    }
+
+    VirtualFileSystem vfs(diskPath);
+    {
+        QuietCout quiet;
+        if (!vfs.createDisk(diskBytes) || !vfs.loadDisk()) return;
+    }
+    const SuperBlock &sb = VfsBenchAccess::superblock(vfs);
+    const uint64_t dataBlocks = sb.totalBlocks - sb.dataStartBlock;
+    vector<uint32_t> onDisk;                    // Pool indexes currently on the disk
+    vector<char> present(AGING_POOL_FILES, 0);
+    uint64_t usedBlocks = 0;
+    vector<double> allocNs;                     // dput latency of every create in the current epoch
+
+    auto create = [&](const uint32_t file) {
+        const auto start = chrono::steady_clock::now();
+        bool ok;
+        {
+            QuietCout quiet;
+            ok = vfs.copyFromHost(poolFiles[file]);
+        }
+        if (!ok) return false;
+        allocNs.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count());
+        onDisk.push_back(file);
+        present[file] = 1;
+        usedBlocks += poolBlocks[file];
+        return true;
+    };
+    auto remove = [&](const size_t slot) {
+        const uint32_t file = onDisk[slot];
+        {
+            QuietCout quiet;
+            vfs.deleteFile(filesystem::path(poolFiles[file]).filename().string());
+        }
+        onDisk[slot] = onDisk.back();
+        onDisk.pop_back();
+        present[file] = 0;
+        usedBlocks -= poolBlocks[file];
+    };
+    auto pickAbsent = [&]() {
+        uint32_t file;
+        do file = uniform_int_distribution<uint32_t>(0, AGING_POOL_FILES - 1)(rng); while (present[file]);
+        return file;
+    };
+    auto utilization = [&]() { return static_cast<uint32_t>(usedBlocks * 100 / dataBlocks); };
+
+    // The first fill, never deleting
+    while (utilization() < AGING_TARGET_PCT && onDisk.size() < MAX_FILES - 1) {
+        if (!create(pickAbsent())) break;
+    }
+
+    for (uint32_t epoch = 0; epoch <= epochs; ++epoch) {
+        if (epoch > 0) {
+            // Churn: below the target mostly create, at or above it mostly delete, always a bit of both
+            allocNs.clear();
+            for (uint32_t op = 0; op < opsPerEpoch; ++op) {
+                const bool below = utilization() < AGING_TARGET_PCT;
+                const bool wantCreate = uniform_int_distribution<uint32_t>(0, 3)(rng) < (below ? 3u : 1u);
+                if (onDisk.empty() || (wantCreate && onDisk.size() < MAX_FILES - 1)) {
+                    if (create(pickAbsent())) continue;
+                }
+                if (!onDisk.empty()) remove(uniform_int_distribution<size_t>(0, onDisk.size() - 1)(rng));
+            }
+        }
+        const string tag = "aging/epoch" + to_string(epoch) + "/";
+        const uint32_t fillPct = utilization();
+
+        // Fragments per file
+        vector<double> fragments;
+        uint64_t bytes = 0;
+        for (const auto &entry: VfsBenchAccess::directory(vfs)) {
+            if (entry.name[0] == '\0') continue;
+            fragments.push_back(chainFragments(vfs, entry));
+            bytes += entry.size;
+        }
+        if (fragments.empty()) continue;
+        results.push_back(countResult(tag + "fragments", diskBytes, fillPct, fragments, "fragments/file"));
+
+        // Reading every file back with a cold cache, fragmented chains mean more seeks
+        const vector<double> readNs = timeReps(options, [&] { dropCache(diskPath); }, [&] {
+            QuietCout quiet;
+            for (const auto &entry: VfsBenchAccess::directory(vfs)) {
+                if (entry.name[0] != '\0') vfs.copyToHost(entry.name, readBack);
+            }
+        });
+        results.push_back(summarise(tag + "read", diskBytes, fillPct, 1, readNs, static_cast<double>(bytes), "MB/s"));
+
+        // Allocation: the dput latency of this epoch's creates, and the bare free block search
+        if (!allocNs.empty()) {
+            results.push_back(summarise(tag + "dput", diskBytes, fillPct, 1, allocNs, 1, "ops/s"));
+        }
+        vector<int32_t> blocks;
+        const uint32_t want = static_cast<uint32_t>(min<uint64_t>(IO_BATCH_BLOCKS, dataBlocks - usedBlocks));
+        results.push_back(runBench(tag + "findFreeBlocks", diskBytes, fillPct, options, want, "blocks/s", [&] {
+            VfsBenchAccess::findFreeBlocks(vfs, want, blocks);
+            keep(blocks.data());
+        }));
+        cerr << "done: aging epoch " << epoch << ", " << onDisk.size() << " files, " << fillPct << "% full\n";
+    }
+    filesystem::remove_all(root);
+}
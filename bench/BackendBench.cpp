@@ -0,0 +1,144 @@
+// BackendBench.cpp
+// The same put and get passes on every data layout the VFS can use (plain, split, striped, mirrored,
+// parity, tiered) and, where it applies, every stripe unit, then a put/get matrix with the fastest
+// choice per workload on stderr. Run it with --dir on the device to tune for
+// The block size is fixed by the disk format, the stripe unit sets how much goes to a member per request
+#include "BenchUtil.h"
+#include <filesystem>
+#include <iomanip>
+
+using namespace std;
+
+struct Backend {
+    string name;
+    DiskLayout layout;
+};
+
+static vector<Backend> backends(const bool quick) {
+    vector<Backend> list;
+    DiskLayout layout;
+    list.push_back({"plain", layout});
+    layout.imageType = IMAGE_SPLIT;
+    layout.members = {"data.vd"};
+    list.push_back({"split", layout});
+    layout.imageType = IMAGE_TIERED;
+    layout.members = {"fast.vd", "slow.vd"};
+    list.push_back({"tiered", layout});   // fastBlocks is set per disk size
+
+    const vector<uint32_t> units = quick ? vector<uint32_t>{16} : vector<uint32_t>{4, 16, 64};
+    for (const uint32_t unit: units) {
+        layout = DiskLayout();
+        layout.stripeBlocks = unit;
+        layout.imageType = IMAGE_STRIPED;
+        layout.members = {"m0.vd", "m1.vd"};
+        list.push_back({"striped-2x" + to_string(unit), layout});
+        layout.members = {"m0.vd", "m1.vd", "m2.vd", "m3.vd"};
+        list.push_back({"striped-4x" + to_string(unit), layout});
+        layout.imageType = IMAGE_MIRRORED;
+        layout.members = {"m0.vd", "m1.vd"};
+        list.push_back({"mirrored-2x" + to_string(unit), layout});
+        layout.imageType = IMAGE_PARITY;
+        layout.members = {"m0.vd", "m1.vd", "m2.vd"};
+        list.push_back({"parity-3x" + to_string(unit), layout});
+    }
+    return list;
+}
+
+void runBackendSuite(const BenchOptions &options, const std::string &dir, const bool quick,
+                     std::vector<BenchResult> &results) {
+    const filesystem::path root = filesystem::path(dir) / ("vfs_bench-" + to_string(getpid()));
+    const filesystem::path source = root / "src", output = root / "out";
+    const string diskPath = (root / "backend.vd").string();
+    filesystem::remove_all(root);
+    filesystem::create_directories(source);
+    filesystem::create_directories(output);
+
+    // Mid-sized files, big enough to span many stripe units
+    const uint32_t fileCount = quick ? 8 : 32;
+    const uint64_t fileSize = quick ? 256 << 10 : 1 << 20;
+    mt19937_64 rng(11);
+    vector<string> names;
+    for (uint32_t i = 0; i < fileCount; ++i) {
+        names.push_back("backend-" + to_string(i) + ".bin");
+        if (!writeHostFile((source / names.back()).string(), fileSize, rng)) {
+            cerr << "Error: Cannot create benchmark file in '" << source.string() << "'\n";
+            return;
+        }
+    }
+    const uint64_t totalBlocks = fileCount * fileSize / BLOCK_SIZE;
+    const uint64_t diskBytes = (totalBlocks + totalBlocks / 64 + 1024) * BLOCK_SIZE;
+    const double bytes = static_cast<double>(fileCount * fileSize);
+
+    struct Row {
+        string name;
+        double put = 0, get = 0;  // MB/s at the median
+    };
+    vector<Row> matrix;
+    for (Backend backend: backends(quick)) {
+        if (backend.layout.imageType == IMAGE_TIERED) {
+            backend.layout.fastBlocks = static_cast<uint32_t>(diskBytes / BLOCK_SIZE / 2);
+        }
+        auto removeDisk = [&] {
+            filesystem::remove(diskPath);
+            filesystem::remove(diskPath + STATS_SUFFIX);
+            for (const auto &member: backend.layout.members) filesystem::remove(root / member);
+        };
+        auto files = [&] {
+            vector<string> paths{diskPath};
+            for (const auto &member: backend.layout.members) paths.push_back((root / member).string());
+            return paths;
+        };
+
+        // Warm page cache throughout: the differences left are the layouts' own work and request sizes
+        bool created = true;
+        const vector<double> put = timeReps(options, [&] {
+            QuietCout quiet;
+            removeDisk();
+            created = VirtualFileSystem(diskPath).createDisk(static_cast<uint32_t>(diskBytes), backend.layout);
+            for (const auto &name: names) warmCache((source / name).string());
+        }, [&] {
+            QuietCout quiet;
+            VirtualFileSystem vfs(diskPath);
+            if (!created || !vfs.loadDisk()) return;
+            for (const auto &name: names) vfs.copyFromHost((source / name).string());
+        });
+        if (!created) {
+            cerr << "skipped " << backend.name << ": cannot create the disk\n";
+            removeDisk();
+            continue;
+        }
+        const vector<double> get = timeReps(options, [&] {
+            for (const auto &name: names) filesystem::remove(output / name);
+            for (const auto &path: files()) warmCache(path);
+        }, [&] {
+            QuietCout quiet;
+            VirtualFileSystem vfs(diskPath);
+            if (!vfs.loadDisk(true)) return;
+            for (const auto &name: names) vfs.copyToHost(name, (output / name).string());
+        });
+        removeDisk();
+
+        results.push_back(summarise("backend/put/" + backend.name, diskBytes, 0, 1, put, bytes, "MB/s"));
+        const double putMBs = results.back().throughput;
+        results.push_back(summarise("backend/get/" + backend.name, diskBytes, 0, 1, get, bytes, "MB/s"));
+        matrix.push_back({backend.name, putMBs, results.back().throughput});
+        cerr << "done: " << backend.name << "\n";
+    }
+    filesystem::remove_all(root);
+    if (matrix.empty()) return;
+
+    // The matrix, and the best layout for writes, reads and both (geometric mean of the two)
+    cerr << "\n" << left << setw(18) << "Layout" << right << setw(12) << "put MB/s" << setw(12) << "get MB/s" << "\n";
+    cerr << string(42, '-') << "\n" << fixed << setprecision(1);
+    for (const auto &row: matrix) {
+        cerr << left << setw(18) << row.name << right << setw(12) << row.put << setw(12) << row.get << "\n";
+    }
+    auto best = [&](const function<double(const Row &)> &score) {
+        return max_element(matrix.begin(), matrix.end(), [&](const Row &a, const Row &b) {
+            return score(a) < score(b);
+        })->name;
+    };
+    cerr << "Recommended for writes: " << best([](const Row &r) { return r.put; })
+            << ", reads: " << best([](const Row &r) { return r.get; })
+            << ", mixed: " << best([](const Row &r) { return sqrt(r.put * r.get); }) << "\n";
+}
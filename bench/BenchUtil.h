@@ -0,0 +1,270 @@
+//
+// Small benchmark harness for vfs_bench: warmup, calibrated repetitions, CSV/JSON reports
+// No dependencies beyond the standard library, so it builds wherever the VFS does
+//
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+#include    <algorithm>
+#include    <chrono>
+#include    <cmath>
+#include    <cstdint>
+#include    <cstdio>
+#include    <fstream>
+#include    <functional>
+#include    <iostream>
+#include    <random>
+#include    <streambuf>
+#include    <string>
+#include    <vector>
+#include    <fcntl.h>
+#include    <unistd.h>
+#include    "VirtualFileSystem.h"
+
+// Lets the benchmarks reach the private helpers they measure, VirtualFileSystem names it a friend
+struct VfsBenchAccess {
+    static const SuperBlock &superblock(const VirtualFileSystem &vfs) { return vfs.sb; }
+    static std::vector<int32_t> &fat(VirtualFileSystem &vfs) { return vfs.FAT; }
+    static std::vector<DirEntry> &directory(VirtualFileSystem &vfs) { return vfs.directory; }
+    static bool readFAT(VirtualFileSystem &vfs) { return vfs.readFAT(); }
+    static bool writeFAT(VirtualFileSystem &vfs) { return vfs.writeFAT(); }
+    static bool writeDirectory(VirtualFileSystem &vfs) { return vfs.writeDirectory(); }
+    static bool findFreeBlocks(const VirtualFileSystem &vfs, const uint32_t count, std::vector<int32_t> &blocks) {
+        return vfs.findFreeBlocks(count, blocks);
+    }
+    static int findDirectoryEntry(const VirtualFileSystem &vfs, const std::string &name) {
+        return vfs.findDirectoryEntry(name);
+    }
+};
+
+// Keep the compiler from optimising a result away
+template<typename T>
+inline void keep(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Swallows std::cout while alive, the VFS reports everything it does there
+class QuietCout {
+public:
+    QuietCout() : saved(std::cout.rdbuf(&sink)) {
+    }
+
+    ~QuietCout() { std::cout.rdbuf(saved); }
+
+private:
+    struct NullBuffer : std::streambuf {
+        int overflow(const int c) override { return c; }
+        std::streamsize xsputn(const char *, const std::streamsize n) override { return n; }
+    } sink;
+
+    std::streambuf *saved;
+};
+
+struct BenchOptions {
+    std::string vfsBinary;              // The vfs program, for suites that time whole invocations
+    uint32_t warmupReps = 2;            // Repetitions run and thrown away first
+    uint32_t reps = 10;                 // Measured repetitions
+    double minRepSeconds = 0.02;        // Each repetition runs enough iterations to last at least this long
+};
+
+struct BenchResult {
+    std::string name;                   // What was measured
+    uint64_t diskBytes = 0;             // Disk size the benchmark ran on
+    uint32_t fillPct = 0;               // Share of data blocks in use
+    uint64_t iterations = 0;            // Iterations per repetition
+    uint32_t reps = 0;
+    double nsMedian = 0, nsMean = 0, nsStddev = 0, nsMin = 0;   // Time per operation
+    double nsP99 = 0, nsP999 = 0;       // Tail, only meaningful with many samples (one per operation)
+    double throughput = 0;              // Units per second, at the median
+    std::string unit;                   // "MB/s", "blocks/s" or "ops/s", or what value counts
+    bool timed = true;                  // False for counts, which have a value instead of times and throughput
+    double value = 0;                   // Counts only: the mean over the samples
+};
+
+// Turn the time per operation of every repetition into a result
+// unitsPerOp is what one operation moves or visits (bytes for MB/s, blocks for blocks/s, 1 for ops/s)
+inline BenchResult summarise(const std::string &name, const uint64_t diskBytes, const uint32_t fillPct,
+                             const uint64_t iterations, std::vector<double> perOp, const double unitsPerOp,
+                             const std::string &unit) {
+    std::sort(perOp.begin(), perOp.end());
+    BenchResult result;
+    result.name = name;
+    result.diskBytes = diskBytes;
+    result.fillPct = fillPct;
+    result.iterations = iterations;
+    result.reps = static_cast<uint32_t>(perOp.size());
+    result.nsMin = perOp.front();
+    result.nsMedian = perOp.size() % 2 ? perOp[perOp.size() / 2]
+                                       : (perOp[perOp.size() / 2 - 1] + perOp[perOp.size() / 2]) / 2;
+    // Nearest rank
+    auto percentile = [&](const double p) {
+        return perOp[std::min(perOp.size() - 1, static_cast<size_t>(std::ceil(p * perOp.size())) - 1)];
+    };
+    result.nsP99 = percentile(0.99);
+    result.nsP999 = percentile(0.999);
+    for (const double ns: perOp) result.nsMean += ns;
+    result.nsMean /= static_cast<double>(perOp.size());
+    for (const double ns: perOp) result.nsStddev += (ns - result.nsMean) * (ns - result.nsMean);
+    result.nsStddev = std::sqrt(result.nsStddev / static_cast<double>(perOp.size()));
+    const double scale = unit == "MB/s" ? 1e-6 : 1.0;
+    result.throughput = unitsPerOp * scale * 1e9 / result.nsMedian;
+    result.unit = unit;
+    return result;
+}
+
+// A count rather than a time (fragments per file, ...), averaged over one sample per item measured
+inline BenchResult countResult(const std::string &name, const uint64_t diskBytes, const uint32_t fillPct,
+                               const std::vector<double> &samples, const std::string &unit) {
+    BenchResult result;
+    result.name = name;
+    result.diskBytes = diskBytes;
+    result.fillPct = fillPct;
+    result.iterations = samples.size();
+    result.reps = 1;
+    result.timed = false;
+    for (const double sample: samples) result.value += sample;
+    if (!samples.empty()) result.value /= static_cast<double>(samples.size());
+    result.unit = unit;
+    return result;
+}
+
+// Run op() in calibrated batches and summarise the time per call
+inline BenchResult runBench(const std::string &name, const uint64_t diskBytes, const uint32_t fillPct,
+                            const BenchOptions &options, const double unitsPerOp, const std::string &unit,
+                            const std::function<void()> &op) {
+    using clock = std::chrono::steady_clock;
+    auto timeBatch = [&](const uint64_t iterations) {
+        const auto start = clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) op();
+        return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    };
+
+    // Double the batch until one takes long enough to time reliably
+    uint64_t iterations = 1;
+    while (timeBatch(iterations) < options.minRepSeconds * 1e9 && iterations < (1ULL << 30)) {
+        iterations *= 2;
+    }
+    for (uint32_t i = 0; i < options.warmupReps; ++i) timeBatch(iterations);
+
+    std::vector<double> perOp;
+    for (uint32_t i = 0; i < options.reps; ++i) {
+        perOp.push_back(timeBatch(iterations) / static_cast<double>(iterations));
+    }
+    return summarise(name, diskBytes, fillPct, iterations, perOp, unitsPerOp, unit);
+}
+
+// For operations too big to batch: setup() runs untimed before every repetition, op() once timed
+// Returns the nanoseconds of each measured repetition
+inline std::vector<double> timeReps(const BenchOptions &options, const std::function<void()> &setup,
+                                    const std::function<void()> &op) {
+    using clock = std::chrono::steady_clock;
+    std::vector<double> ns;
+    for (uint32_t i = 0; i < options.warmupReps + options.reps; ++i) {
+        setup();
+        const auto start = clock::now();
+        op();
+        const double elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        if (i >= options.warmupReps) ns.push_back(elapsed);
+    }
+    return ns;
+}
+
+// Host files and the page cache, for the suites that go through dput/dget
+static constexpr size_t COPY_BUFFER = IO_BATCH_BLOCKS * BLOCK_SIZE;  // Host copies move as much per call as dput
+
+// Random contents, written a buffer at a time
+inline bool writeHostFile(const std::string &path, uint64_t size, std::mt19937_64 &rng) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::vector<uint64_t> buffer(COPY_BUFFER / sizeof(uint64_t));
+    while (size > 0 && out) {
+        for (auto &word: buffer) word = rng();
+        const auto chunk = static_cast<std::streamsize>(std::min<uint64_t>(size, COPY_BUFFER));
+        out.write(reinterpret_cast<const char *>(buffer.data()), chunk);
+        size -= chunk;
+    }
+    return out.good();
+}
+
+// Write back and evict a file's pages, the next read comes from the device
+inline void dropCache(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// Pull a file into the page cache
+inline void warmCache(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    std::vector<char> buffer(COPY_BUFFER);
+    while (read(fd, buffer.data(), buffer.size()) > 0) {
+    }
+    close(fd);
+}
+
+// Suites, one source file each
+void runMicroSuite(const BenchOptions &options, const std::string &dir, bool quick,
+                   std::vector<BenchResult> &results);          // vfs_bench.cpp
+void runThroughputSuite(const BenchOptions &options, const std::string &dir, bool quick,
+                        std::vector<BenchResult> &results);     // ThroughputBench.cpp
+void runAgingSuite(const BenchOptions &options, const std::string &dir, bool quick,
+                   std::vector<BenchResult> &results);          // AgingBench.cpp
+void runMetadataSuite(const BenchOptions &options, const std::string &dir, bool quick,
+                      std::vector<BenchResult> &results);       // MetadataBench.cpp
+void runBackendSuite(const BenchOptions &options, const std::string &dir, bool quick,
+                     std::vector<BenchResult> &results);        // BackendBench.cpp
+void runScalingSuite(const BenchOptions &options, const std::string &dir, bool quick,
+                     std::vector<BenchResult> &results);        // ScalingBench.cpp
+
+// One row per result, header first
+// Timed rows leave value empty, counts leave the times and throughput empty
+inline void printCsv(const std::vector<BenchResult> &results, std::ostream &out) {
+    out << "benchmark,disk_bytes,fill_pct,reps,iterations,ns_op_median,ns_op_mean,ns_op_stddev,ns_op_min,"
+            "ns_op_p99,ns_op_p999,throughput,value,unit\n";
+    for (const auto &r: results) {
+        char line[256];
+        if (r.timed) {
+            std::snprintf(line, sizeof(line), "%llu,%u,%u,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f,,",
+                          static_cast<unsigned long long>(r.diskBytes), r.fillPct, r.reps,
+                          static_cast<unsigned long long>(r.iterations), r.nsMedian, r.nsMean, r.nsStddev, r.nsMin,
+                          r.nsP99, r.nsP999, r.throughput);
+        } else {
+            std::snprintf(line, sizeof(line), "%llu,%u,%u,%llu,,,,,,,,%.3f,",
+                          static_cast<unsigned long long>(r.diskBytes), r.fillPct, r.reps,
+                          static_cast<unsigned long long>(r.iterations), r.value);
+        }
+        out << r.name << "," << line << r.unit << "\n";
+    }
+}
+
+// An array of objects with the same fields as the CSV columns, null where the CSV is empty
+inline void printJson(const std::vector<BenchResult> &results, std::ostream &out) {
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto &r = results[i];
+        char fields[448];
+        if (r.timed) {
+            std::snprintf(fields, sizeof(fields),
+                          "\"disk_bytes\": %llu, \"fill_pct\": %u, \"reps\": %u, \"iterations\": %llu, "
+                          "\"ns_op_median\": %.1f, \"ns_op_mean\": %.1f, \"ns_op_stddev\": %.1f, \"ns_op_min\": %.1f, "
+                          "\"ns_op_p99\": %.1f, \"ns_op_p999\": %.1f, \"throughput\": %.3f, \"value\": null",
+                          static_cast<unsigned long long>(r.diskBytes), r.fillPct, r.reps,
+                          static_cast<unsigned long long>(r.iterations), r.nsMedian, r.nsMean, r.nsStddev, r.nsMin,
+                          r.nsP99, r.nsP999, r.throughput);
+        } else {
+            std::snprintf(fields, sizeof(fields),
+                          "\"disk_bytes\": %llu, \"fill_pct\": %u, \"reps\": %u, \"iterations\": %llu, "
+                          "\"ns_op_median\": null, \"ns_op_mean\": null, \"ns_op_stddev\": null, \"ns_op_min\": null, "
+                          "\"ns_op_p99\": null, \"ns_op_p999\": null, \"throughput\": null, \"value\": %.3f",
+                          static_cast<unsigned long long>(r.diskBytes), r.fillPct, r.reps,
+                          static_cast<unsigned long long>(r.iterations), r.value);
+        }
+        out << "  {\"benchmark\": \"" << r.name << "\", " << fields << ", \"unit\": \"" << r.unit << "\"}"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+#endif //BENCHUTIL_H
@@ -0,0 +1,128 @@
+// MetadataBench.cpp
+// Create/lookup/stat/rename/delete storms on one-block files: every operation is timed on its
+// own, so the results carry p50/p99/p999 latency next to ops/s. Runs in-process against the API
+// and, for the commands that exist, as separate vfs invocations (process start and the full
+// metadata load included). Files are at least one block, dput refuses empty host files
+#include "BenchUtil.h"
+#include <filesystem>
+#include <spawn.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+static constexpr uint32_t META_FILES = 60;      // Files per round, nearly the whole directory
+
+// One operation, timed
+template<typename Op>
+static void timeOp(vector<double> &samples, Op &&op) {
+    const auto start = chrono::steady_clock::now();
+    op();
+    samples.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count());
+}
+
+// ops/s over the whole storm rather than at the median, so slow outliers count
+static BenchResult storm(const string &name, const uint64_t diskBytes, const vector<double> &samples) {
+    BenchResult result = summarise(name, diskBytes, 0, 1, samples, 1, "ops/s");
+    result.throughput = 1e9 / result.nsMean;
+    return result;
+}
+
+// Run the vfs program with the given arguments and its output thrown away
+static bool runVfs(const string &binary, const vector<string> &args) {
+    vector<char *> argv{const_cast<char *>(binary.c_str())};
+    for (const auto &arg: args) argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    const bool started = posix_spawn(&pid, binary.c_str(), &actions, nullptr, argv.data(), environ) == 0;
+    posix_spawn_file_actions_destroy(&actions);
+    int status = 0;
+    return started && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void runMetadataSuite(const BenchOptions &options, const std::string &dir, const bool quick,
+                      std::vector<BenchResult> &results) {
+    const filesystem::path root = filesystem::path(dir) / ("vfs_bench-" + to_string(getpid()));
+    const string diskPath = (root / "meta.vd").string();
+    filesystem::remove_all(root);
+    filesystem::create_directories(root);
+
+    // 1 to 512 bytes each
+    mt19937_64 rng(3);
+    vector<string> hostFiles, names;
+    for (uint32_t i = 0; i < META_FILES; ++i) {
+        names.push_back("meta-" + to_string(i) + ".bin");
+        hostFiles.push_back((root / names.back()).string());
+        writeHostFile(hostFiles.back(), 1 + rng() % BLOCK_SIZE, rng);
+    }
+
+    // dput and ddel rewrite the whole FAT, so the disk size matters for them
+    vector<pair<uint32_t, uint32_t> > sizes = {{1 << 20, 20000}, {100 << 20, 2000}};   // Size, creates to time
+    if (quick) sizes = {{1 << 20, 1000}};
+    for (const auto &[diskBytes, creates]: sizes) {
+        VirtualFileSystem vfs(diskPath);
+        {
+            QuietCout quiet;
+            if (!vfs.createDisk(diskBytes) || !vfs.loadDisk()) return;
+        }
+        vector<double> create, lookup, stat, rename, remove;
+        DirEntry info{};
+        QuietCout quiet;
+        while (create.size() < creates) {
+            for (uint32_t i = 0; i < META_FILES; ++i) timeOp(create, [&] { vfs.copyFromHost(hostFiles[i]); });
+            for (uint32_t i = 0; i < META_FILES; ++i) {
+                timeOp(lookup, [&] { keep(VfsBenchAccess::findDirectoryEntry(vfs, names[i])); });
+            }
+            for (uint32_t i = 0; i < META_FILES; ++i) timeOp(stat, [&] { vfs.statFile(names[i], info); });
+            for (uint32_t i = 0; i < META_FILES; ++i) {
+                timeOp(rename, [&] { vfs.renameFile(names[i], names[i] + ".r"); });
+                timeOp(rename, [&] { vfs.renameFile(names[i] + ".r", names[i]); });
+            }
+            for (uint32_t i = 0; i < META_FILES; ++i) timeOp(remove, [&] { vfs.deleteFile(names[i]); });
+        }
+        results.push_back(storm("metadata/create", diskBytes, create));
+        results.push_back(storm("metadata/lookup", diskBytes, lookup));
+        results.push_back(storm("metadata/stat", diskBytes, stat));
+        results.push_back(storm("metadata/rename", diskBytes, rename));
+        results.push_back(storm("metadata/delete", diskBytes, remove));
+        cerr << "done: in-process metadata storm, " << diskBytes << " bytes\n";
+    }
+
+    // Each operation a whole vfs run, as scripts see it
+    if (options.vfsBinary.empty() || !filesystem::exists(options.vfsBinary)) {
+        cerr << "skipped cross-process metadata storm: vfs program not found, pass --vfs=<path>\n";
+    } else {
+        const uint32_t diskBytes = 1 << 20, rounds = quick ? 1 : 4;
+        const string &vfs = options.vfsBinary;
+        vector<double> create, stat, rename, remove;
+        bool ok = runVfs(vfs, {"dmake", diskPath, to_string(diskBytes)});
+        for (uint32_t round = 0; round < rounds && ok; ++round) {
+            for (uint32_t i = 0; i < META_FILES; ++i) {
+                timeOp(create, [&] { ok &= runVfs(vfs, {"dput", diskPath, hostFiles[i]}); });
+            }
+            for (uint32_t i = 0; i < META_FILES; ++i) {
+                timeOp(stat, [&] { ok &= runVfs(vfs, {"dstat", diskPath, names[i]}); });
+            }
+            for (uint32_t i = 0; i < META_FILES; ++i) {
+                timeOp(rename, [&] { ok &= runVfs(vfs, {"drename", diskPath, names[i], names[i] + ".r"}); });
+                timeOp(rename, [&] { ok &= runVfs(vfs, {"drename", diskPath, names[i] + ".r", names[i]}); });
+            }
+            for (uint32_t i = 0; i < META_FILES; ++i) {
+                timeOp(remove, [&] { ok &= runVfs(vfs, {"ddel", diskPath, names[i]}); });
+            }
+        }
+        if (!ok) {
+            cerr << "Error: A vfs invocation failed during the cross-process metadata storm\n";
+        } else {
+            results.push_back(storm("metadata/create/process", diskBytes, create));
+            results.push_back(storm("metadata/stat/process", diskBytes, stat));
+            results.push_back(storm("metadata/rename/process", diskBytes, rename));
+            results.push_back(storm("metadata/delete/process", diskBytes, remove));
+            cerr << "done: cross-process metadata storm\n";
+        }
+    }
+    filesystem::remove_all(root);
+}
@@ -0,0 +1,145 @@
+// ScalingBench.cpp
+// Read-only, write-only and mixed work on one disk from 1 to N workers, as threads in this process
+// and as forked processes. Every operation is a whole command: load the disk (taking its lock),
+// one get or put, close. Reports ops/s, efficiency against N times the one-worker rate, and the
+// share of the time the workers spent waiting for the disk lock (the "lock" metric of each load)
+#include "BenchUtil.h"
+#include <filesystem>
+#include <iomanip>
+#include <thread>
+#include <sys/wait.h>
+
+using namespace std;
+
+static constexpr uint32_t SCALING_READ_FILES = 32;     // Files gets pick from
+static constexpr uint32_t READ_PERCENT_MIXED = 70;     // Gets in the mixed workload
+
+enum Workload { READ_ONLY, WRITE_ONLY, MIXED };
+
+// One worker's share: gets of random files, and puts that replace the worker's own file
+// Returns the nanoseconds spent waiting for the disk lock, read-only loads don't leave them in .stats
+static uint64_t runWorker(const string &diskPath, const filesystem::path &source, const Workload workload,
+                          const uint32_t worker, const uint32_t ops) {
+    mt19937_64 rng(worker + 1);
+    const string own = "w" + to_string(worker) + ".bin";
+    uint64_t lockNs = 0;
+    for (uint32_t i = 0; i < ops; ++i) {
+        const bool read = workload == READ_ONLY || (workload == MIXED && rng() % 100 < READ_PERCENT_MIXED);
+        VirtualFileSystem vfs(diskPath);
+        if (!vfs.loadDisk(read)) break;
+        if (read) {
+            vfs.copyToHost("r" + to_string(rng() % SCALING_READ_FILES) + ".bin", "/dev/null");
+        } else {
+            vfs.deleteFile(own);    // Put in the setup, so there is always one to replace
+            vfs.copyFromHost((source / own).string());
+        }
+        lockNs += vfs.metrics().ops[METRIC_LOCK].totalNs;
+    }
+    return lockNs;
+}
+
+// All workers at once, returns when the last one is done with the lock wait of all of them
+// Forked workers send theirs back through a pipe
+static uint64_t runPass(const string &diskPath, const filesystem::path &source, const Workload workload,
+                        const uint32_t workers, const uint32_t opsPerWorker, const bool processes) {
+    QuietCout quiet;
+    uint64_t lockNs = 0;
+    if (processes) {
+        int fds[2];
+        if (pipe(fds) != 0) return 0;
+        cout.flush();
+        vector<pid_t> children;
+        for (uint32_t w = 0; w < workers; ++w) {
+            const pid_t pid = fork();
+            if (pid == 0) {
+                close(fds[0]);
+                const uint64_t waited = runWorker(diskPath, source, workload, w, opsPerWorker);
+                const bool sent = write(fds[1], &waited, sizeof(waited)) == sizeof(waited);
+                _exit(sent ? 0 : 1);   // The disks are closed already, nothing of the parent's gets flushed twice
+            }
+            if (pid > 0) children.push_back(pid);
+        }
+        close(fds[1]);
+        uint64_t waited;
+        while (read(fds[0], &waited, sizeof(waited)) == sizeof(waited)) lockNs += waited;
+        close(fds[0]);
+        for (const pid_t pid: children) waitpid(pid, nullptr, 0);
+    } else {
+        vector<uint64_t> waited(workers);
+        vector<thread> threads;
+        for (uint32_t w = 0; w < workers; ++w) {
+            threads.emplace_back([&, w] { waited[w] = runWorker(diskPath, source, workload, w, opsPerWorker); });
+        }
+        for (auto &worker: threads) worker.join();
+        for (const uint64_t ns: waited) lockNs += ns;
+    }
+    return lockNs;
+}
+
+void runScalingSuite(const BenchOptions &options, const std::string &dir, const bool quick,
+                     std::vector<BenchResult> &results) {
+    const filesystem::path root = filesystem::path(dir) / ("vfs_bench-" + to_string(getpid()));
+    const filesystem::path source = root / "src";
+    const string diskPath = (root / "scaling.vd").string();
+    filesystem::remove_all(root);
+    filesystem::create_directories(source);
+
+    const uint32_t maxWorkers = min(quick ? 4u : 16u, max(2u, thread::hardware_concurrency()));
+    const uint32_t opsPerWorker = quick ? 16 : 64;
+    const uint64_t fileSize = quick ? 16 << 10 : 64 << 10;
+    vector<uint32_t> counts;
+    for (uint32_t n = 1; n <= maxWorkers; n *= 2) counts.push_back(n);
+
+    // Files to read, and one per worker to put
+    mt19937_64 rng(5);
+    vector<string> readFiles, workerFiles;
+    for (uint32_t i = 0; i < SCALING_READ_FILES; ++i) {
+        readFiles.push_back((source / ("r" + to_string(i) + ".bin")).string());
+        writeHostFile(readFiles.back(), fileSize, rng);
+    }
+    for (uint32_t w = 0; w < maxWorkers; ++w) {
+        workerFiles.push_back((source / ("w" + to_string(w) + ".bin")).string());
+        writeHostFile(workerFiles.back(), fileSize, rng);
+    }
+    const uint64_t blocks = (SCALING_READ_FILES + maxWorkers) * ((fileSize + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    const uint64_t diskBytes = (blocks * 2 + 1024) * BLOCK_SIZE;
+    {
+        QuietCout quiet;
+        VirtualFileSystem vfs(diskPath);
+        if (!VirtualFileSystem(diskPath).createDisk(static_cast<uint32_t>(diskBytes)) || !vfs.loadDisk()) {
+            cerr << "Error: Cannot create the scaling disk in '" << root.string() << "'\n";
+            return;
+        }
+        for (const auto &file: readFiles) vfs.copyFromHost(file);
+        for (const auto &file: workerFiles) vfs.copyFromHost(file);
+    }
+
+    const char *workloadNames[] = {"read", "write", "mixed"};
+    cerr << "\n" << left << setw(10) << "Workers" << setw(8) << "as" << setw(8) << "work" << right << setw(12)
+            << "ops/s" << setw(12) << "Efficiency" << setw(12) << "Lock wait" << "\n";
+    cerr << string(62, '-') << "\n" << fixed << setprecision(1);
+    for (const bool processes: {false, true}) {
+        for (const Workload workload: {READ_ONLY, WRITE_ONLY, MIXED}) {
+            double single = 0;
+            for (const uint32_t workers: counts) {
+                uint64_t lockNs = 0;    // Of the last repetition
+                const vector<double> ns = timeReps(options, [] {}, [&] {
+                    lockNs = runPass(diskPath, source, workload, workers, opsPerWorker, processes);
+                });
+                const string name = string("scaling/") + (processes ? "processes/" : "threads/") +
+                                    workloadNames[workload] + "/" + to_string(workers);
+                results.push_back(summarise(name, diskBytes, 0, 1, ns, workers * opsPerWorker, "ops/s"));
+                const double opsPerSecond = results.back().throughput;
+                if (workers == 1) single = opsPerSecond;
+
+                // The last repetition's lock waits against the workers' time
+                const double lockShare = 100.0 * static_cast<double>(lockNs) / (workers * ns.back());
+                cerr << left << setw(10) << workers << setw(8) << (processes ? "procs" : "threads")
+                        << setw(8) << workloadNames[workload] << right << setw(12) << opsPerSecond
+                        << setw(11) << (single > 0 ? 100.0 * opsPerSecond / (workers * single) : 0) << "%"
+                        << setw(11) << lockShare << "%\n";
+            }
+        }
+    }
+    filesystem::remove_all(root);
+}
@@ -0,0 +1,150 @@
+// ThroughputBench.cpp
+// End-to-end dput/dget throughput on realistic file size mixes, next to a plain host copy of the
+// same files, with a cold (posix_fadvise DONTNEED) and a warm page cache
+// Neither side syncs, so both measure the path into and out of the page cache
+#include "BenchUtil.h"
+#include <filesystem>
+#include <random>
+
+using namespace std;
+
+static constexpr uint32_t MIX_FILES = 48;                       // Files per mix, the directory holds 64
+
+struct FileMix {
+    string name;
+    function<uint64_t(mt19937_64 &)> size;
+};
+
+// uniform: small files up to 1 MB; lognormal: median 64 KB with a long tail;
+// bimodal: mostly tiny files plus a few of half to full maxFile
+static vector<FileMix> fileMixes(const uint64_t maxFile) {
+    return {
+        {"uniform", [](mt19937_64 &rng) { return uniform_int_distribution<uint64_t>(1, 1 << 20)(rng); }},
+        {"lognormal", [maxFile](mt19937_64 &rng) {
+            const double size = lognormal_distribution<double>(log(64.0 * 1024), 2.5)(rng);
+            return clamp(static_cast<uint64_t>(size), uint64_t{1}, maxFile);
+        }},
+        {"bimodal", [maxFile](mt19937_64 &rng) {
+            if (uniform_int_distribution<uint32_t>(0, 9)(rng) > 0) {
+                return uniform_int_distribution<uint64_t>(1, 16 * 1024)(rng);
+            }
+            return uniform_int_distribution<uint64_t>(maxFile / 2, maxFile)(rng);
+        }},
+    };
+}
+
+// The baseline: read()/write() with the same chunk size dput and dget use
+static bool copyHostFile(const string &from, const string &to) {
+    const int in = open(from.c_str(), O_RDONLY);
+    const int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = in >= 0 && out >= 0;
+    vector<char> buffer(COPY_BUFFER);
+    ssize_t got;
+    while (ok && (got = read(in, buffer.data(), buffer.size())) > 0) {
+        ok = write(out, buffer.data(), got) == got;
+    }
+    if (in >= 0) close(in);
+    if (out >= 0) close(out);
+    return ok;
+}
+
+void runThroughputSuite(const BenchOptions &options, const std::string &dir, const bool quick,
+                        std::vector<BenchResult> &results) {
+    const uint64_t maxFile = quick ? 4ULL << 20 : 128ULL << 20;
+    const filesystem::path root = filesystem::path(dir) / ("vfs_bench-" + to_string(getpid()));
+    const filesystem::path source = root / "src", hostCopy = root / "host", output = root / "out";
+    const string diskPath = (root / "bench.vd").string();
+
+    for (const auto &mix: fileMixes(maxFile)) {
+        filesystem::remove_all(root);
+        filesystem::create_directories(source);
+        filesystem::create_directories(hostCopy);
+        filesystem::create_directories(output);
+
+        // The same files for every run of a mix
+        mt19937_64 rng(7);
+        vector<string> names;
+        uint64_t totalBytes = 0, totalBlocks = 0;
+        for (uint32_t i = 0; i < (quick ? MIX_FILES / 4 : MIX_FILES); ++i) {
+            const uint64_t size = mix.size(rng);
+            names.push_back(mix.name + "-" + to_string(i) + ".bin");
+            if (!writeHostFile((source / names.back()).string(), size, rng)) {
+                cerr << "Error: Cannot create benchmark file in '" << source.string() << "'\n";
+                return;
+            }
+            totalBytes += size;
+            totalBlocks += (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        }
+        // Room for the files, their FAT entries and the fixed metadata, plus a little slack
+        const uint64_t diskBytes = min<uint64_t>((totalBlocks + totalBlocks / 64 + 1024) * BLOCK_SIZE,
+                                                 UINT32_MAX / BLOCK_SIZE * BLOCK_SIZE);
+        const auto fillPct = static_cast<uint32_t>(totalBlocks * BLOCK_SIZE * 100 / diskBytes);
+        const double files = static_cast<double>(names.size()), bytes = static_cast<double>(totalBytes);
+
+        for (const bool cold: {true, false}) {
+            const string cache = cold ? "cold" : "warm";
+            // Copies always go into new files, the source (and disk) get the page cache state being measured
+            auto prepare = [&](const filesystem::path &from, const vector<string> &extra, const filesystem::path &to) {
+                for (const auto &name: names) {
+                    filesystem::remove(to / name);
+                    if (cold) dropCache((from / name).string());
+                    else warmCache((from / name).string());
+                }
+                for (const auto &path: extra) {
+                    if (cold) dropCache(path);
+                    else warmCache(path);
+                }
+            };
+            auto report = [&](const string &name, const vector<double> &ns) {
+                results.push_back(summarise(name + "/" + mix.name + "/" + cache, diskBytes, fillPct, 1, ns, bytes,
+                                            "MB/s"));
+                results.push_back(summarise(name + "/" + mix.name + "/" + cache, diskBytes, fillPct, 1, ns, files,
+                                            "files/s"));
+            };
+
+            // put: host files into a fresh disk, and into a directory for the baseline
+            const vector<double> hostPut = timeReps(options, [&] { prepare(source, {}, hostCopy); }, [&] {
+                for (const auto &name: names) copyHostFile((source / name).string(), (hostCopy / name).string());
+            });
+            const vector<double> vfsPut = timeReps(options, [&] {
+                QuietCout quiet;
+                VirtualFileSystem(diskPath).createDisk(static_cast<uint32_t>(diskBytes));
+                prepare(source, {diskPath}, root / "none");
+            }, [&] {
+                QuietCout quiet;
+                VirtualFileSystem vfs(diskPath);
+                if (!vfs.loadDisk()) return;
+                for (const auto &name: names) vfs.copyFromHost((source / name).string());
+            });
+
+            // get: everything back out again
+            const vector<double> hostGet = timeReps(options, [&] { prepare(hostCopy, {}, output); }, [&] {
+                for (const auto &name: names) copyHostFile((hostCopy / name).string(), (output / name).string());
+            });
+            const vector<double> vfsGet = timeReps(options, [&] { prepare(root / "none", {diskPath}, output); }, [&] {
+                QuietCout quiet;
+                VirtualFileSystem vfs(diskPath);
+                if (!vfs.loadDisk(true)) return;
+                for (const auto &name: names) vfs.copyToHost(name, (output / name).string());
+            });
+
+            report("put/host", hostPut);
+            report("put/vfs", vfsPut);
+            report("get/host", hostGet);
+            report("get/vfs", vfsGet);
+            // How many times longer the VFS takes than the plain copy, at the medians
+            const size_t put = results.size() - 8;  // put/host, put/vfs, get/host, get/vfs, two rows each
+            for (const string op: {"put", "get"}) {
+                const BenchResult host = results[put + (op == "put" ? 0 : 4)];
+                const BenchResult vfs = results[put + (op == "put" ? 2 : 6)];
+                BenchResult overhead = vfs;
+                overhead.name = "overhead/" + op + "/" + mix.name + "/" + cache;
+                overhead.throughput = vfs.nsMedian / host.nsMedian;
+                overhead.unit = "x";
+                results.push_back(overhead);
+            }
+        }
+        cerr << "done: " << mix.name << " mix, " << names.size() << " files, " << totalBytes << " bytes\n";
+    }
+    filesystem::remove_all(root);
+}
@@ -0,0 +1,216 @@
+// vfs_bench.cpp
+// Micro-benchmarks of the VFS hot paths (free block search, directory lookup, FAT I/O,
+// FAT chain walk, dmap) over a few disk sizes and fill levels, and the driver for all suites
+// Usage: vfs_bench [--suite=micro|throughput|aging|metadata|backends|scaling|all] [--format=csv|json] [--reps=N] [--quick]
+//                  [--dir=<scratch dir>] [--vfs=<vfs program>]
+#include "BenchUtil.h"
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <unistd.h>    // for getpid()
+
+using namespace std;
+
+static constexpr uint32_t BENCH_FILES = 48;         // Files on a filled disk, 3/4 of the directory
+static constexpr uint32_t BENCH_RUN_BLOCKS = 8;     // Files get their blocks in runs of this many, interleaved
+static constexpr uint32_t FREE_SEARCH_BLOCKS = 256; // Blocks findFreeBlocks looks for, one dput batch
+
+// Mark fillPct percent of the data blocks (picked at random) as used by BENCH_FILES files
+// Runs of blocks alternate between the files, so the chains jump around like on an aged disk
+static void fillDisk(VirtualFileSystem &vfs, const uint32_t fillPct) {
+    const SuperBlock &sb = VfsBenchAccess::superblock(vfs);
+    vector<int32_t> &fat = VfsBenchAccess::fat(vfs);
+    vector<DirEntry> &directory = VfsBenchAccess::directory(vfs);
+
+    vector<vector<int32_t> > chains(BENCH_FILES);
+    mt19937 rng(42);
+    for (uint32_t blk = sb.dataStartBlock; blk < sb.totalBlocks; ++blk) {
+        if (rng() % 100 < fillPct) chains[(blk / BENCH_RUN_BLOCKS) % BENCH_FILES].push_back(static_cast<int32_t>(blk));
+    }
+    for (uint32_t file = 0; file < BENCH_FILES; ++file) {
+        const vector<int32_t> &chain = chains[file];
+        if (chain.empty()) continue;
+        for (size_t i = 0; i < chain.size(); ++i) {
+            fat[chain[i]] = i + 1 < chain.size() ? chain[i + 1] : -1;
+        }
+        DirEntry &entry = directory[file];
+        memset(&entry, 0, sizeof(entry));
+        snprintf(entry.name, sizeof(entry.name), "file%02u.bin", file);
+        entry.size = chain.size() * BLOCK_SIZE;
+        entry.type = 'F';
+        entry.firstBlock = chain[0];
+    }
+    VfsBenchAccess::writeFAT(vfs);
+    VfsBenchAccess::writeDirectory(vfs);
+}
+
+// Same walk as dget: follow the FAT from the first block until the file size is covered
+static size_t walkChain(VirtualFileSystem &vfs, const DirEntry &entry) {
+    const vector<int32_t> &fat = VfsBenchAccess::fat(vfs);
+    size_t blocks = 0;
+    for (int32_t blk = entry.firstBlock; blk >= 0 && blocks * BLOCK_SIZE < entry.size; blk = fat[blk]) {
+        ++blocks;
+    }
+    return blocks;
+}
+
+static void benchDisk(const string &path, const uint32_t diskBytes, const uint32_t fillPct,
+                      const BenchOptions &options, vector<BenchResult> &results) {
+    VirtualFileSystem vfs(path);
+    {
+        QuietCout quiet;
+        if (!vfs.createDisk(diskBytes) || !vfs.loadDisk()) return;
+    }
+    fillDisk(vfs, fillPct);
+    const SuperBlock &sb = VfsBenchAccess::superblock(vfs);
+
+    vector<int32_t> blocks;
+    if (VfsBenchAccess::findFreeBlocks(vfs, FREE_SEARCH_BLOCKS, blocks)) {
+        results.push_back(runBench("findFreeBlocks", diskBytes, fillPct, options, FREE_SEARCH_BLOCKS, "blocks/s", [&] {
+            VfsBenchAccess::findFreeBlocks(vfs, FREE_SEARCH_BLOCKS, blocks);
+            keep(blocks.data());
+        }));
+    }
+
+    // The longest chain, and a name near the end of the directory for lookups
+    const vector<DirEntry> &directory = VfsBenchAccess::directory(vfs);
+    const DirEntry *longest = nullptr, *last = nullptr;
+    for (const auto &entry: directory) {
+        if (entry.name[0] == '\0') continue;
+        last = &entry;
+        if (!longest || entry.size > longest->size) longest = &entry;
+    }
+    if (last) {
+        const string name = last->name;
+        results.push_back(runBench("findDirectoryEntry/hit", diskBytes, fillPct, options, 1, "ops/s", [&] {
+            keep(VfsBenchAccess::findDirectoryEntry(vfs, name));
+        }));
+    }
+    const string missing = "missing.bin";
+    results.push_back(runBench("findDirectoryEntry/miss", diskBytes, fillPct, options, 1, "ops/s", [&] {
+        keep(VfsBenchAccess::findDirectoryEntry(vfs, missing));
+    }));
+
+    const double fatBytes = static_cast<double>(sb.fatBlockCount) * BLOCK_SIZE;
+    results.push_back(runBench("readFAT", diskBytes, fillPct, options, fatBytes, "MB/s", [&] {
+        keep(VfsBenchAccess::readFAT(vfs));
+    }));
+    results.push_back(runBench("writeFAT", diskBytes, fillPct, options, fatBytes, "MB/s", [&] {
+        keep(VfsBenchAccess::writeFAT(vfs));
+    }));
+
+    if (longest) {
+        const double chainBlocks = static_cast<double>(walkChain(vfs, *longest));
+        results.push_back(runBench("chainWalk", diskBytes, fillPct, options, chainBlocks, "blocks/s", [&] {
+            keep(walkChain(vfs, *longest));
+        }));
+    }
+
+    QuietCout quiet;
+    results.push_back(runBench("showMap", diskBytes, fillPct, options, sb.totalBlocks, "blocks/s", [&] {
+        vfs.showMap();
+    }));
+}
+
+void runMicroSuite(const BenchOptions &options, const std::string &dir, const bool quick,
+                   std::vector<BenchResult> &results) {
+    vector<uint32_t> sizes = {1024 * 1024, 10 * 1024 * 1024, 100 * 1024 * 1024};
+    vector<uint32_t> fills = {0, 50, 90};
+    if (quick) {
+        sizes = {1024 * 1024};
+        fills = {50};
+    }
+    const string path = (filesystem::path(dir) / ("vfs_bench-" + to_string(getpid()) + ".vd")).string();
+    for (const uint32_t size: sizes) {
+        for (const uint32_t fill: fills) {
+            benchDisk(path, size, fill, options, results);
+            cerr << "done: " << size << " bytes, " << fill << "% full\n";
+        }
+    }
+    filesystem::remove(path);
+    filesystem::remove(path + STATS_SUFFIX);
+}
+
+int main(const int argc, char *argv[]) {
+    const string usage = " [--suite=micro|throughput|aging|metadata|backends|scaling|all] [--format=csv|json] [--reps=N] [--quick] [--dir=<scratch dir>]"
+                         " [--vfs=<vfs program>]";
+    string format = "csv", suite = "micro";
+    BenchOptions options;
+    bool quick = false, repsGiven = false;
+    string dir = filesystem::temp_directory_path().string();
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg.rfind("--format=", 0) == 0) {
+            format = arg.substr(9);
+        } else if (arg.rfind("--suite=", 0) == 0) {
+            suite = arg.substr(8);
+        } else if (arg.rfind("--reps=", 0) == 0) {
+            options.reps = static_cast<uint32_t>(stoul(arg.substr(7)));
+            repsGiven = true;
+        } else if (arg.rfind("--dir=", 0) == 0) {
+            dir = arg.substr(6);
+        } else if (arg.rfind("--vfs=", 0) == 0) {
+            options.vfsBinary = arg.substr(6);
+        } else if (arg == "--quick") {
+            quick = true;
+        } else {
+            cerr << "Usage: " << argv[0] << usage << "\n";
+            return 1;
+        }
+    }
+    if ((format != "csv" && format != "json") || (suite != "micro" && suite != "throughput" && suite != "aging" &&
+                                                  suite != "metadata" && suite != "backends" &&
+                                                  suite != "scaling" && suite != "all") ||
+        options.reps == 0) {
+        cerr << "Usage: " << argv[0] << usage << "\n";
+        return 1;
+    }
+    if (quick) {
+        options.warmupReps = 1;
+        if (!repsGiven) options.reps = 3;
+    }
+
+    // The vfs program is built next to vfs_bench or one directory up
+    if (options.vfsBinary.empty()) {
+        const filesystem::path self = filesystem::path(argv[0]).parent_path();
+        for (const auto &candidate: {self / "vfs", self / ".." / "vfs"}) {
+            if (filesystem::exists(candidate)) {
+                options.vfsBinary = candidate.string();
+                break;
+            }
+        }
+    }
+
+    vector<BenchResult> results;
+    if (suite == "micro" || suite == "all") runMicroSuite(options, dir, quick, results);
+    if (suite == "throughput" || suite == "all") {
+        // Whole put/get passes, a few repetitions are plenty
+        BenchOptions passes = options;
+        passes.warmupReps = 1;
+        if (!repsGiven) passes.reps = 3;
+        runThroughputSuite(passes, dir, quick, results);
+    }
+    if (suite == "aging" || suite == "all") {
+        BenchOptions passes = options;
+        passes.warmupReps = 0;
+        if (!repsGiven) passes.reps = 3;
+        runAgingSuite(passes, dir, quick, results);
+    }
+    if (suite == "metadata" || suite == "all") runMetadataSuite(options, dir, quick, results);
+    if (suite == "backends" || suite == "all") {
+        BenchOptions passes = options;
+        passes.warmupReps = 1;
+        if (!repsGiven) passes.reps = 3;
+        runBackendSuite(passes, dir, quick, results);
+    }
+    if (suite == "scaling" || suite == "all") {
+        BenchOptions passes = options;
+        passes.warmupReps = 1;
+        if (!repsGiven) passes.reps = 3;
+        runScalingSuite(passes, dir, quick, results);
+    }
+
+    if (format == "json") printJson(results, cout);
+    else printCsv(results, cout);
+    return 0;
+}
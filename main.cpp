@@ -1,5 +1,17 @@
 #include <iostream>
+#include <ctime>
+#include <iomanip>
+#include <cstdio>
+#include <filesystem>
+#include <sys/stat.h>  // for stat()
 #include "VirtualFileSystem.h"
+#include "ShardedVolume.h"
+#include "Trace.h"
+#include "IoStats.h"
+#include "Profile.h"
+#include "Format.h"
+#include "Heat.h"
+#include "Workload.h"
 
 using namespace std;
 
@@ -8,28 +20,160 @@ void printAbout() {
     cout << "Version - Alpha 0.1" << endl << endl;
 }
 
+// Print the counters of a .stats file, latencies in microseconds
+void printStats(const MetricsSnapshot &snapshot, const uint32_t format) {
+    if (format == FORMAT_JSON) {
+        // Exact nanoseconds, and the histogram as [bucket_low_ns, calls] pairs
+        cout << "{\"ops\":{";
+        bool first = true;
+        for (uint32_t i = 0; i < METRIC_OPS; ++i) {
+            const OpMetrics &op = snapshot.ops[i];
+            if (op.count == 0) continue;
+            cout << (first ? "\n" : ",\n") << "\"" << metricName(static_cast<MetricOp>(i)) << "\":{\"count\":"
+                    << op.count << ",\"errors\":" << op.errors << ",\"bytes\":" << op.bytes << ",\"total_ns\":"
+                    << op.totalNs << ",\"mean_ns\":" << op.totalNs / op.count << ",\"p50_ns\":"
+                    << op.percentile(0.5) << ",\"p90_ns\":" << op.percentile(0.9) << ",\"p99_ns\":"
+                    << op.percentile(0.99) << ",\"p999_ns\":" << op.percentile(0.999) << ",\"max_ns\":"
+                    << op.maxNs << ",\"histogram\":[";
+            bool firstBucket = true;
+            for (uint32_t bucket = 0; bucket < HIST_BUCKETS; ++bucket) {
+                if (op.buckets[bucket] == 0) continue;
+                cout << (firstBucket ? "" : ",") << "[" << histBucketLow(bucket) << "," << op.buckets[bucket] << "]";
+                firstBucket = false;
+            }
+            cout << "]}";
+            first = false;
+        }
+        cout << (first ? "" : "\n") << "}}\n";
+        return;
+    }
+    if (format == FORMAT_CSV) {
+        cout << "op,count,errors,bytes,total_ns,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n";
+        for (uint32_t i = 0; i < METRIC_OPS; ++i) {
+            const OpMetrics &op = snapshot.ops[i];
+            if (op.count == 0) continue;
+            cout << metricName(static_cast<MetricOp>(i)) << "," << op.count << "," << op.errors << "," << op.bytes
+                    << "," << op.totalNs << "," << op.totalNs / op.count << "," << op.percentile(0.5) << ","
+                    << op.percentile(0.9) << "," << op.percentile(0.99) << "," << op.percentile(0.999) << ","
+                    << op.maxNs << "\n";
+        }
+        return;
+    }
+    cout << left << setw(8) << "Op" << right << setw(10) << "Count" << setw(8) << "Errors" << setw(12) << "MB"
+            << setw(10) << "Mean" << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99"
+            << setw(10) << "p99.9" << setw(10) << "Max" << "\n";
+    cout << string(98, '-') << "\n";
+    cout << fixed << setprecision(1);
+    for (uint32_t i = 0; i < METRIC_OPS; ++i) {
+        const OpMetrics &op = snapshot.ops[i];
+        if (op.count == 0) continue;
+        cout << left << setw(8) << metricName(static_cast<MetricOp>(i)) << right << setw(10) << op.count
+                << setw(8) << op.errors << setw(12) << op.bytes / 1e6
+                << setw(10) << op.totalNs / 1e3 / op.count << setw(10) << op.percentile(0.5) / 1e3
+                << setw(10) << op.percentile(0.9) / 1e3 << setw(10) << op.percentile(0.99) / 1e3
+                << setw(10) << op.percentile(0.999) / 1e3 << setw(10) << op.maxNs / 1e3 << "\n";
+    }
+}
+
 // Print usage in case the entered command is wrong
 void printUsage(const string &programName) {
     cout << "Usage: " << programName << " <command> [options]" << endl;
     cout << "----------------------------------------" << endl;
     cout << "dmake   <diskfile> [size_bytes] <- Create a new virtual disk file with optional size" << "\n" <<
             "(default 10MB, min 4096 bytes, max 100MB)" << endl;
-    cout << "dremove <diskfile> <- Remove the virtual disk file" << endl;
+    cout << "dmake   <diskfile> <size_bytes> --data <datafile> <- Create a disk that keeps only the metadata" << "\n" <<
+            "(superblock, directory, FAT) in diskfile and all data blocks in datafile" << endl;
+    cout << "dmake   <diskfile> <size_bytes> --tier <fast_blocks> <fastfile> <slowfile> <- Create a disk that keeps" << "\n" <<
+            "its hottest data blocks in a small fast file and the rest in a slow file" << endl;
+    cout << "dmake   <diskfile> <size_bytes> --stripe <unit_blocks> <member1> <member2> [...] <- Create a disk" << "\n" <<
+            "whose data blocks are striped over 2 to " << MAX_MEMBERS << " member files" << endl;
+    cout << "dmake   <diskfile> <size_bytes> --mirror <read_unit_blocks> <member1> <member2> [...] <- Create a disk" << "\n" <<
+            "whose data blocks are mirrored on every member file, reads are spread over the members" << endl;
+    cout << "dmake   <diskfile> <size_bytes> --parity <unit_blocks> <1|2> <member1> <member2> <member3> [...] <- Create a" << "\n" <<
+            "disk striped over the members with 1 (RAID-5) or 2 (RAID-6) parity units per stripe" << endl;
+    cout << "dremove <diskfile> <- Remove the virtual disk file and its member files" << endl;
     cout << "dput    <diskfile> <localfile> <- Copy a local file to the virtual disk" << endl;
     cout << "dget    <diskfile> <filename> [dest] <- Copy a file from the virtual disk" << endl;
+    cout << "dcp     <srcdisk>:<filename> <dstdisk>[:<newname>] <- Copy a file from one virtual disk to another" << endl;
     cout << "ddel    <diskfile> <filename> <- Deletes a file from the virtual disk" << endl;
-    cout << "dls     <diskfile> <- List files in the virtual disk" << endl;
-    cout << "dmap    <diskfile> <- Show block occupation on the virtual disk" << endl;
+    cout << "drename <diskfile> <filename> <newname> <- Rename a file on the virtual disk" << endl;
+    cout << "dstat   <diskfile> <filename> <- Show the size, blocks and creation time of a file" << endl;
+    cout << "dstats  <diskfile> [--reset] [--format=table|json|csv] <- Show operation counts and latencies (us)" << "\n" <<
+            "recorded for the disk, or clear them" << endl;
+    cout << "dls     <diskfile> [--format=table|json|csv] <- List files in the virtual disk" << endl;
+    cout << "dmap    <diskfile> [--format=table|json|csv] <- Show block occupation on the virtual disk" << endl;
+    cout << "dfrag   <diskfile> [--format=table|json] <- Show fragments per file, free extent sizes and the seeks" << "\n" <<
+            "needed to read every file" << endl;
+    cout << "dheat   <diskfile> [top_n] [--reset] <- Show the most accessed files (default top 10), a heatmap of" << "\n" <<
+            "the data blocks and the cache size holding the hot part, from accesses sampled with --heat-sample" << endl;
+    cout << "drebuild <diskfile> <- Rebuild missing or out-of-date member files of a mirrored or parity disk" << endl;
+    cout << "dtier   <diskfile> [budget_blocks] <- Move hot blocks of a tiered disk to its fast tier and cold ones" << "\n" <<
+            "back, copying at most budget_blocks blocks (default 1024)" << endl;
+    cout << "dgrow   <diskfile> <size_bytes> <- Grow the virtual disk to a larger size (max 100MB)" << endl;
+    cout << "dshrink <diskfile> [size_bytes] <- Shrink the virtual disk (default: as small as the files allow)" << endl;
+    cout << "doverlay <overlayfile> <basefile> <- Create an overlay disk on top of a read-only base disk" << endl;
+    cout << "dcommit <overlayfile> <- Merge the changes of an overlay disk into its base disk" << endl;
+    cout << "vmake   <volume> <shard_size_bytes> <shard1> [shard2 ...] <- Create a volume whose files are spread" << "\n" <<
+            "over the given shard disks by a hash of their names" << endl;
+    cout << "vput    <volume> <localfile> [...] <- Copy local files to the volume, shards are written in parallel" << endl;
+    cout << "vget    <volume> <filename> [dest] <- Copy a file from the volume" << endl;
+    cout << "vdel    <volume> <filename> <- Delete a file from the volume" << endl;
+    cout << "vls     <volume> <- List the files on every shard of the volume" << endl;
+    cout << "vaddshard <volume> <diskfile> [size_bytes] <- Add a new shard disk and move the files it now owns to it" << endl;
+    cout << "vrebalance <volume> <- Move every file that is not on the shard owning its name" << endl;
+    cout << "dbench  <jobfile> <- Run the synthetic workloads of an INI-style job file (operation mix, file sizes," << "\n" <<
+            "threads, access order, target rate) and report throughput and latency percentiles per job" << endl;
+    cout << "replay  <tracefile> <diskfile> [--fast] [size_bytes] <- Play a recorded trace against a disk, creating" << "\n" <<
+            "the disk if it doesn't exist; --fast drops the pauses between operations" << endl;
     cout << "help <- Show this help message" << endl;
     cout << "about <- For more information about the program" << endl;
+    cout << "----------------------------------------" << endl;
+    cout << "Global options, accepted anywhere on the command line:" << endl;
+    cout << "--trace=<file> <- Append a record of every create, read, delete, rename and stat to file" << endl;
+    cout << "--io-stats <- When done, print the reads, writes and seeks made per disk region, the write" << "\n" <<
+            "amplification and the syscall counts" << endl;
+    cout << "--heat-sample=<n> <- Count about one in n data block accesses in the disk's .heat file, for dheat" << endl;
+    cout << "--profile <- When done, print the tree of phases the command went through, with calls, wall and" << "\n" <<
+            "CPU time and heap allocations per phase" << endl;
+    cout << "--chrome-trace=<file> <- Write a timeline of the phases, I/O runs and waits of every thread to file," << "\n" <<
+            "in Chrome trace-event JSON (open in chrome://tracing or ui.perfetto.dev)" << endl;
 }
 
-int main(const int argc, char *argv[]) {
+int main(int argc, char *argv[]) {
+    // Global options are taken out of argv so the commands below never see them
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (const string arg = argv[i]; arg.rfind("--trace=", 0) == 0) {
+            VirtualFileSystem::traceTo(arg.substr(8));
+        } else if (arg == "--io-stats") {
+            enableIoStats();
+        } else if (arg.rfind("--heat-sample=", 0) == 0) {
+            const unsigned long oneIn = strtoul(arg.c_str() + 14, nullptr, 10);
+            if (oneIn == 0 || oneIn > UINT32_MAX) {
+                cerr << "Error: Invalid sampling rate '" << arg.substr(14) << "'\n";
+                return 1;
+            }
+            enableHeatSampling(static_cast<uint32_t>(oneIn));
+        } else if (arg == "--profile") {
+            if (!enableProfile()) cerr << "Warning: Built without VFS_PROFILE, --profile does nothing" << endl;
+        } else if (arg.rfind("--chrome-trace=", 0) == 0) {
+            if (!enableChromeTrace(arg.substr(15))) {
+                cerr << "Warning: Built without VFS_PROFILE, --chrome-trace does nothing" << endl;
+            }
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+
     if (argc < 2) {
         printUsage(argv[0]);
         return 1;
     }
 
+    PROFILE_SCOPE(argv[1]);
+
     // Complaint: 'string' not being allowed in a switch statement, ridiculous
     // Thus using good-old if-else chain instead
 
@@ -52,7 +196,31 @@ int main(const int argc, char *argv[]) {
                 return 1;
             }
         }
-        if (VirtualFileSystem vfs(diskName); !vfs.createDisk(size)) return 1;
+        // Optional layout, member files follow the layout option
+        DiskLayout layout;
+        if (argc >= 5) {
+            if (const string option = argv[4]; (option == "--stripe" || option == "--mirror") && argc >= 6) {
+                layout.imageType = option == "--stripe" ? IMAGE_STRIPED : IMAGE_MIRRORED;
+                layout.stripeBlocks = static_cast<uint32_t>(stoul(argv[5]));
+                layout.members.assign(argv + 6, argv + argc);
+            } else if (option == "--data" && argc == 6) {
+                layout.imageType = IMAGE_SPLIT;
+                layout.members.assign(argv + 5, argv + argc);
+            } else if (option == "--tier" && argc == 8) {
+                layout.imageType = IMAGE_TIERED;
+                layout.fastBlocks = static_cast<uint32_t>(stoul(argv[5]));
+                layout.members.assign(argv + 6, argv + argc);
+            } else if (option == "--parity" && argc >= 7) {
+                layout.imageType = IMAGE_PARITY;
+                layout.stripeBlocks = static_cast<uint32_t>(stoul(argv[5]));
+                layout.parityCount = static_cast<uint32_t>(stoul(argv[6]));
+                layout.members.assign(argv + 7, argv + argc);
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        if (VirtualFileSystem vfs(diskName); !vfs.createDisk(size, layout)) return 1;
     } else if (cmd == "dremove") {
         if (argc < 3) {
             printUsage(argv[0]);
@@ -85,6 +253,41 @@ int main(const int argc, char *argv[]) {
         VirtualFileSystem vfs(diskName);
         if (!vfs.loadDisk()) return 1;
         vfs.copyToHost(fileName, dest);
+    } else if (cmd == "dcp") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        // Split at the last ':', so disk paths may contain one
+        const string from = argv[2], to = argv[3];
+        const size_t fromColon = from.rfind(':'), toColon = to.rfind(':');
+        if (fromColon == string::npos || fromColon + 1 == from.size()) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        const string srcDisk = from.substr(0, fromColon), fileName = from.substr(fromColon + 1);
+        const string dstDisk = toColon == string::npos ? to : to.substr(0, toColon);
+        const string newName = toColon == string::npos ? "" : to.substr(toColon + 1);
+        // A copy within one disk goes through one object, a second one would wait on the first one's lock
+        error_code ec;
+        if (filesystem::equivalent(srcDisk, dstDisk, ec)) {
+            VirtualFileSystem vfs(srcDisk);
+            if (!vfs.loadDisk() || !vfs.copyToDisk(fileName, vfs, newName)) return 1;
+        } else if (VirtualFileSystem(srcDisk).isBackedBy(dstDisk)) {
+            cerr << "Error: '" << dstDisk << "' is a base image of '" << srcDisk
+                    << "', it can't be written while the overlay reads from it" << endl;
+            return 1;
+        } else {
+            // Two copies in opposite directions would each hold one disk and wait for the other,
+            // so the disks are locked in inode order whichever way the copy goes
+            VirtualFileSystem src(srcDisk), dst(dstDisk);
+            struct stat srcInfo{}, dstInfo{};
+            const bool dstFirst = stat(srcDisk.c_str(), &srcInfo) == 0 && stat(dstDisk.c_str(), &dstInfo) == 0 &&
+                                  make_pair(dstInfo.st_dev, dstInfo.st_ino) < make_pair(srcInfo.st_dev, srcInfo.st_ino);
+            if (dstFirst ? !dst.loadDisk() || !src.loadDisk(true) : !src.loadDisk(true) || !dst.loadDisk()) return 1;
+            if (!src.copyToDisk(fileName, dst, newName)) return 1;
+        }
     } else if (cmd == "ddel") {
         if (argc < 4) {
             printUsage(argv[0]);
@@ -96,26 +299,316 @@ int main(const int argc, char *argv[]) {
         VirtualFileSystem vfs(diskName);
         if (!vfs.loadDisk()) return 1;
         vfs.deleteFile(fileName);
+    } else if (cmd == "drename") {
+        if (argc < 5) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string diskName = argv[2];
+        const string fileName = argv[3];
+        const string newName = argv[4];
+        VirtualFileSystem vfs(diskName);
+        if (!vfs.loadDisk()) return 1;
+        if (!vfs.renameFile(fileName, newName)) return 1;
+    } else if (cmd == "dstat") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string diskName = argv[2];
+        const string fileName = argv[3];
+        VirtualFileSystem vfs(diskName);
+        DirEntry info{};
+        if (!vfs.loadDisk(true) || !vfs.statFile(fileName, info)) return 1;
+        char created[20];
+        strftime(created, sizeof(created), "%Y-%m-%d %H:%M:%S", localtime(&info.created));
+        cout << "Name:    " << info.name << "\n"
+                << "Size:    " << info.size << " bytes\n"
+                << "Blocks:  " << (info.size + BLOCK_SIZE - 1) / BLOCK_SIZE << " (first " << info.firstBlock << ")\n"
+                << "Created: " << created << "\n";
+    } else if (cmd == "dstats") {
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string statsName = string(argv[2]) + STATS_SUFFIX;
+        bool reset = false;
+        uint32_t format = FORMAT_TABLE;
+        for (int i = 3; i < argc; ++i) {
+            const string arg = argv[i];
+            if (arg == "--reset") reset = true;
+            else if (!parseFormat(arg, format)) {
+                cerr << "Error: Unknown option '" << arg << "'\n";
+                return 1;
+            }
+        }
+        if (reset) {
+            remove(statsName.c_str());
+            cout << "Statistics of '" << argv[2] << "' cleared.\n";
+            return 0;
+        }
+        MetricsSnapshot snapshot;
+        if (!readStatsFile(statsName, snapshot) || snapshot.empty()) {
+            // Scripts still get a document they can parse
+            if (format == FORMAT_TABLE) cout << "No statistics recorded for '" << argv[2] << "' yet.\n";
+            else printStats(MetricsSnapshot(), format);
+            return 0;
+        }
+        printStats(snapshot, format);
     } else if (cmd == "dls") {
         if (argc < 3) {
             printUsage(argv[0]);
             return 1;
         }
 
+        uint32_t format = FORMAT_TABLE;
+        if (argc >= 4 && !parseFormat(argv[3], format)) {
+            cerr << "Error: Unknown option '" << argv[3] << "'\n";
+            return 1;
+        }
         const string diskName = argv[2];
         VirtualFileSystem vfs(diskName);
-        if (!vfs.loadDisk()) return 1;
-        vfs.listFiles();
+        if (!vfs.loadDisk(true)) return 1;
+        vfs.listFiles(format);
     } else if (cmd == "dmap") {
         if (argc < 3) {
             printUsage(argv[0]);
             return 1;
         }
 
+        uint32_t format = FORMAT_TABLE;
+        if (argc >= 4 && !parseFormat(argv[3], format)) {
+            cerr << "Error: Unknown option '" << argv[3] << "'\n";
+            return 1;
+        }
+        const string diskName = argv[2];
+        VirtualFileSystem vfs(diskName);
+        if (!vfs.loadDisk(true)) return 1;
+        vfs.showMap(format);
+    } else if (cmd == "dfrag") {
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        uint32_t format = FORMAT_TABLE;
+        if (argc >= 4 && (!parseFormat(argv[3], format) || format == FORMAT_CSV)) {
+            cerr << "Error: Unknown option '" << argv[3] << "'\n";
+            return 1;
+        }
+        const string diskName = argv[2];
+        VirtualFileSystem vfs(diskName);
+        if (!vfs.loadDisk(true)) return 1;
+        vfs.showFragmentation(format);
+    } else if (cmd == "dheat") {
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        if (argc >= 4 && string(argv[3]) == "--reset") {
+            remove((string(argv[2]) + HEAT_SUFFIX).c_str());
+            cout << "Heat of '" << argv[2] << "' cleared.\n";
+            return 0;
+        }
+        const uint32_t top = argc >= 4 ? static_cast<uint32_t>(stoul(argv[3])) : 10;
+        VirtualFileSystem vfs(argv[2]);
+        if (!vfs.loadDisk(true)) return 1;
+        vfs.showHeat(top);
+    } else if (cmd == "drebuild") {
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
         const string diskName = argv[2];
         VirtualFileSystem vfs(diskName);
         if (!vfs.loadDisk()) return 1;
-        vfs.showMap();
+        if (!vfs.rebuildMembers()) return 1;
+    } else if (cmd == "dtier") {
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string diskName = argv[2];
+        const uint32_t budget = argc >= 4 ? static_cast<uint32_t>(stoul(argv[3])) : 1024;
+        VirtualFileSystem vfs(diskName);
+        if (!vfs.loadDisk()) return 1;
+        if (!vfs.migrateTiers(budget)) return 1;
+    } else if (cmd == "dgrow") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string diskName = argv[2];
+        const auto size = static_cast<uint32_t>(stoul(argv[3]));
+        // Same upper limit as dmake
+        if (size > 100 * 1024 * 1024) {
+            cerr << "Error: Disk size must be between 4096 bytes and 100 MB." << endl;
+            return 1;
+        }
+        VirtualFileSystem vfs(diskName);
+        if (!vfs.loadDisk()) return 1;
+        if (!vfs.growDisk(size)) return 1;
+    } else if (cmd == "dshrink") {
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string diskName = argv[2];
+        uint32_t size = 0;
+        if (argc >= 4) {
+            size = static_cast<uint32_t>(stoul(argv[3]));
+            if (size < 4096) {
+                cerr << "Error: Disk size must be between 4096 bytes and 100 MB." << endl;
+                return 1;
+            }
+        }
+        VirtualFileSystem vfs(diskName);
+        if (!vfs.loadDisk()) return 1;
+        if (!vfs.shrinkDisk(size)) return 1;
+    } else if (cmd == "doverlay") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string overlayName = argv[2];
+        const string baseName = argv[3];
+        if (VirtualFileSystem vfs(overlayName); !vfs.createOverlay(baseName)) return 1;
+    } else if (cmd == "dcommit") {
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string overlayName = argv[2];
+        VirtualFileSystem vfs(overlayName);
+        if (!vfs.loadDisk()) return 1;
+        if (!vfs.commitOverlay()) return 1;
+    } else if (cmd == "vmake") {
+        if (argc < 5) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string volumeName = argv[2];
+        const auto size = static_cast<uint32_t>(stoul(argv[3]));
+        // Same limits as dmake, per shard
+        if (size < 4096 || size > 100 * 1024 * 1024) {
+            cerr << "Error: Disk size must be between 4096 bytes and 100 MB." << endl;
+            return 1;
+        }
+        const vector<string> shards(argv + 4, argv + argc);
+        if (ShardedVolume volume(volumeName); !volume.create(shards, size)) return 1;
+    } else if (cmd == "vput") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string volumeName = argv[2];
+        const vector<string> hostFiles(argv + 3, argv + argc);
+        ShardedVolume volume(volumeName);
+        if (!volume.load()) return 1;
+        if (!volume.putFiles(hostFiles)) return 1;
+    } else if (cmd == "vget") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string volumeName = argv[2];
+        const string fileName = argv[3];
+        const string dest = (argc >= 5 ? argv[4] : "");
+        ShardedVolume volume(volumeName);
+        if (!volume.load()) return 1;
+        if (!volume.getFile(fileName, dest)) return 1;
+    } else if (cmd == "vdel") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string volumeName = argv[2];
+        const string fileName = argv[3];
+        ShardedVolume volume(volumeName);
+        if (!volume.load()) return 1;
+        if (!volume.deleteFile(fileName)) return 1;
+    } else if (cmd == "vls") {
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string volumeName = argv[2];
+        ShardedVolume volume(volumeName);
+        if (!volume.load()) return 1;
+        if (!volume.listFiles()) return 1;
+    } else if (cmd == "vaddshard") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string volumeName = argv[2];
+        const string shardName = argv[3];
+        uint32_t size = DEFAULT_DISK_SIZE;
+        if (argc >= 5) {
+            size = static_cast<uint32_t>(stoul(argv[4]));
+            if (size < 4096 || size > 100 * 1024 * 1024) {
+                cerr << "Error: Disk size must be between 4096 bytes and 100 MB." << endl;
+                return 1;
+            }
+        }
+        ShardedVolume volume(volumeName);
+        if (!volume.load()) return 1;
+        if (!volume.addShard(shardName, size)) return 1;
+    } else if (cmd == "vrebalance") {
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string volumeName = argv[2];
+        ShardedVolume volume(volumeName);
+        if (!volume.load()) return 1;
+        if (!volume.rebalance()) return 1;
+    } else if (cmd == "replay") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        const string traceName = argv[2];
+        const string diskName = argv[3];
+        bool fast = false;
+        uint32_t size = DEFAULT_DISK_SIZE;
+        for (int i = 4; i < argc; ++i) {
+            if (string(argv[i]) == "--fast") {
+                fast = true;
+            } else {
+                size = static_cast<uint32_t>(stoul(argv[i]));
+                if (size < 4096 || size > 100 * 1024 * 1024) {
+                    cerr << "Error: Disk size must be between 4096 bytes and 100 MB." << endl;
+                    return 1;
+                }
+            }
+        }
+        if (!replayTrace(traceName, diskName, fast, size)) return 1;
+    } else if (cmd == "dbench") {
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        if (!runWorkload(argv[2])) return 1;
     } else if (cmd == "help") {
         printUsage(argv[0]);
         return 0;